@@ -0,0 +1,233 @@
+#include "../include/tesuji/benchmark.hpp"
+#include "../include/tesuji/tracked.hpp"
+using namespace tesuji;
+
+#if defined(__has_include) && __has_include(<CLI/CLI.hpp>)
+#    include <CLI/CLI.hpp>
+#else
+#    pragma message("Consider getting https://github.com/CLIUtils/CLI11")
+#endif
+
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#if defined(__GLIBC__)
+#    include <malloc.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// backing_allocators runs one object-heavy workload with tracked::D objects
+// of five sizes on malloc, a pool, an arena and a page resource, see
+// tracked::set_backing_resource(). Every round deletes a third of the objects
+// at random and allocates new ones in their place.
+//
+// Printed per allocator: the time of a round, the bytes of the live objects,
+// the bytes the allocator holds for them, fragmentation as the share of those
+// that isn't live, the peak RSS and the RSS after all objects were freed.
+// Held bytes are what the malloc heap grew by, which is where arena and pool
+// chunks come from too, without the tables of the leak tracker, plus the
+// mappings of the page resource. Every allocator runs in a child process of
+// its own, where fork is available, so the RSS of one doesn't carry over.
+///////////////////////////////////////////////////////////////////////////////
+
+template<size_t Size> struct object : tracked::D
+{
+    char payload[Size - sizeof(tracked::D)];
+};
+
+
+struct entry
+{
+    tracked::D *object;
+    size_t      size;
+};
+
+template<size_t Size> entry make_object() {
+    return {new object<Size>, Size};
+}
+
+constexpr entry (*makers[])() = {make_object<32>, make_object<64>, make_object<128>,
+                                 make_object<256>, make_object<512>};
+
+
+struct workload
+{
+    mt19937       rng{42};
+    vector<entry> objects;
+    uint64_t      liveBytes = 0;
+
+    explicit workload(size_t n) {
+        objects.reserve(n);
+    }
+
+    entry make() {
+        const entry e = makers[rng() % size(makers)]();
+        liveBytes    += e.size;
+        return e;
+    }
+
+    void destroy(const entry &e) {
+        liveBytes -= e.size;
+        delete e.object;
+    }
+
+    void fill(size_t n) {
+        while(objects.size() < n) {
+            objects.push_back(make());
+        }
+    }
+
+    void churn() {
+        for(size_t i = 0; i < objects.size() / 3; ++i) {
+            entry &e = objects[rng() % objects.size()];
+            destroy(e);
+            e = make();
+        }
+    }
+
+    void clear() {
+        for(const entry &e: objects) {
+            destroy(e);
+        }
+        objects.clear();
+    }
+};
+
+
+// What the malloc heap holds, in use or free.
+uint64_t heap_bytes() {
+#if defined(__GLIBC__)
+    const auto info = mallinfo2();
+    return info.arena + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+
+// A field of /proc/self/status in bytes, e.g. VmRSS or VmHWM, the peak.
+uint64_t status_bytes(string_view field) {
+#if defined(__linux__)
+    ifstream status("/proc/self/status");
+    for(string line; getline(status, line);) {
+        if(line.starts_with(field) && line.size() > field.size() && line[field.size()] == ':') {
+            return stoull(line.substr(field.size() + 1)) * 1024; // in kB
+        }
+    }
+#endif
+    (void)field;
+    return 0;
+}
+
+
+// `make` returns the resource, nullptr for malloc.
+timed::call_info run(string_view name, size_t objects, size_t rounds, auto &&make) {
+    auto        &tracker     = tracked::detail::tracked_base::allocs;
+    auto         resource    = make();
+    auto        *pages       = dynamic_cast<page_resource *>(resource.get());
+    workload     w(objects);
+    const double heapBefore  = double(heap_bytes());
+    const double tableBefore = double(tracker.table_bytes());
+
+    tracked::backing_scope scope(resource.get());
+    w.fill(objects);
+    timed::call_info info = timed::calls(name, rounds, [&] { w.churn(); });
+
+    const double held = double(heap_bytes()) - heapBefore
+                      - (double(tracker.table_bytes()) - tableBefore)
+                      + double(pages ? pages->mapped() : 0);
+    info.counters["live_bytes"]    = double(w.liveBytes);
+    info.counters["held_bytes"]    = held;
+    info.counters["fragmentation"] = held > 0 ? 1 - double(w.liveBytes) / held : 0;
+    w.clear();
+    const uint64_t rss = status_bytes("VmRSS"); // the kernel updates VmHWM lazily
+    info.counters["peak_rss"]     = double(max(status_bytes("VmHWM"), rss));
+    info.counters["retained_rss"] = double(rss);
+    return info;
+}
+
+
+int main(int argc, char **argv) {
+    size_t objects     = 20000; // the page resource maps two areas per object
+    size_t rounds      = 20;
+    size_t repetitions = 1;
+    bool   noFork      = false;
+    string jsonFile;
+
+#if defined(CLI11_VERSION)
+    CLI::App app{"one workload of tracked objects on malloc, a pool, an arena and pages"};
+    app.add_option("-n,--objects", objects, "live objects")->default_str(to_string(objects));
+    app.add_option("-i,--rounds", rounds, "rounds that replace a third of the objects")
+        ->default_str(to_string(rounds));
+    app.add_option("-r,--repetitions", repetitions, "number of repetitions")
+        ->default_str(to_string(repetitions));
+    app.add_flag("--no-fork", noFork, "run all allocators in this process");
+    app.add_option("-j,--json", jsonFile, "write Google Benchmark compatible JSON to this file");
+    CLI11_PARSE(app, argc, argv);
+#else
+    if(argc > 1) {
+        objects = stoul(argv[1]);
+    }
+    if(argc > 2) {
+        rounds = stoul(argv[2]);
+    }
+#endif
+
+    tracked::set_silent();
+    tracked::set_stack_depth(0);
+    tracked::set_copy_audit(false);
+
+    using resource_ptr = unique_ptr<pmr::memory_resource>;
+
+    timed::benchmark_runner runner;
+    runner.repetitions = repetitions;
+    if(!noFork) {
+        runner.isolation = timed::benchmark_runner::isolate::per_repetition;
+    }
+    runner.add("malloc", [&] {
+        return run("malloc", objects, rounds, [] { return resource_ptr(); });
+    });
+    runner.add("pool", [&] {
+        return run("pool", objects, rounds, [] { return resource_ptr(make_unique<pool>(512)); });
+    });
+    runner.add("arena", [&] {
+        return run("arena", objects, rounds,
+                   [] { return resource_ptr(make_unique<arena>(1 << 20)); });
+    });
+    runner.add("pages", [&] {
+        return run("pages", objects, rounds,
+                   [] { return resource_ptr(make_unique<page_resource>()); });
+    });
+    runner.run();
+
+    auto human = [](double bytes) {
+        return tracked::bytesToHumanString(uint64_t(max(bytes, 0.0)));
+    };
+    cout << format("\n{:<10} {:>10} {:>12} {:>12} {:>14} {:>12} {:>12}\n", "allocator", "round",
+                   "live", "held", "fragmentation", "peak RSS", "retained");
+    for(const auto &record: runner.records) {
+        if(record.run_type != "iteration") {
+            continue;
+        }
+        const auto &c = record.info.counters;
+        cout << format("{:<10} {:>10} {:>12} {:>12} {:>13.1f}% {:>12} {:>12}\n",
+                       record.run_name, timed::durationToHumanString(record.info.avg),
+                       human(c.at("live_bytes")), human(c.at("held_bytes")),
+                       100 * c.at("fragmentation"), human(c.at("peak_rss")),
+                       human(c.at("retained_rss")));
+    }
+
+    if(!jsonFile.empty()) {
+        ofstream out(jsonFile);
+        runner.write_json(out, argv[0]);
+    }
+
+    return 0;
+}
@@ -1,4 +1,4 @@
-#include "../include/tesuji/timed.hpp"
+#include "../include/tesuji/benchmark.hpp"
 using namespace tesuji;
 
 #if defined(__has_include) && __has_include(<CLI/CLI.hpp>)
@@ -8,6 +8,7 @@ using namespace tesuji;
 #endif
 
 #include <iostream>
+#include <fstream>
 #include <random>
 #include <chrono>
 using namespace std;
@@ -17,32 +18,71 @@ int main(int argc, char **argv) {
     timed::block main_block(__FUNCSIG__);
 
     size_t iterations = 1000000;
+    size_t repetitions = 1;
+    double precision   = 0.01;
+    double minSeconds  = 0.1;
+    double maxSeconds  = 10;
+    bool   isolate     = false;
+    bool   shuffle     = false;
+    string jsonFile;
 
 #if defined(CLI11_VERSION)
     CLI::App app{"comparing random number generation"};
-    app.add_option("-i,--iterations", iterations, "number of iterations")
+    app.add_option("-i,--iterations", iterations, "maximum number of iterations")
         ->default_str(std::to_string(iterations));
+    app.add_option("-p,--precision", precision,
+                   "stop when the median is known within this relative error, 0 to always run "
+                   "all iterations")
+        ->default_str(std::to_string(precision));
+    app.add_option("--min-time", minSeconds, "minimum seconds per benchmark")
+        ->default_str(std::to_string(minSeconds));
+    app.add_option("-t,--max-time", maxSeconds, "maximum seconds per benchmark")
+        ->default_str(std::to_string(maxSeconds));
+    app.add_option("-r,--repetitions", repetitions, "number of repetitions")
+        ->default_str(std::to_string(repetitions));
+    app.add_flag("--fork", isolate, "run every repetition in a fresh child process");
+    app.add_flag("--shuffle", shuffle, "interleave repetitions and randomize the order");
+    app.add_option("-j,--json", jsonFile, "write Google Benchmark compatible JSON to this file");
     CLI11_PARSE(app, argc, argv);
 #endif
 
     random_device rd;
+    auto mersenne       = mt19937_64{rd()};
+    auto minstd         = minstd_rand{rd()};
+    auto ranlux48Engine = ranlux48{rd()};
+    auto knuth_bEngine  = knuth_b{rd()};
+    auto defaultEngine  = default_random_engine{rd()};
 
-    cout << timed::calls("random_device        ", iterations, rd) << endl;
-
-    auto mersenne = mt19937_64{rd()};
-    cout << timed::calls("mt19937_64           ", iterations, mersenne) << endl;
-
-    auto minstd = minstd_rand{rd()};
-    cout << timed::calls("minstd_rand          ", iterations, minstd) << endl;
+    auto toNanoseconds = [](double s) {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(s));
+    };
 
-    auto ranlux48Engine = ranlux48{rd()};
-    cout << timed::calls("ranlux48             ", iterations, ranlux48Engine) << endl;
+    const timed::stop_rule rule{
+        .min_count = precision > 0 ? 1 : iterations,
+        .max_count = iterations,
+        .min_time  = toNanoseconds(minSeconds),
+        .max_time  = toNanoseconds(maxSeconds),
+        .precision = precision,
+    };
 
-    auto knuth_bEngine = knuth_b{rd()};
-    cout << timed::calls("knuth_b              ", iterations, knuth_bEngine) << endl;
+    timed::benchmark_runner runner;
+    runner.repetitions = repetitions;
+    runner.shuffle     = shuffle;
+    if(isolate) {
+        runner.isolation = timed::benchmark_runner::isolate::per_repetition;
+    }
+    runner.add("random_device", rule, rd);
+    runner.add("mt19937_64", rule, mersenne);
+    runner.add("minstd_rand", rule, minstd);
+    runner.add("ranlux48", rule, ranlux48Engine);
+    runner.add("knuth_b", rule, knuth_bEngine);
+    runner.add("default_random_engine", rule, defaultEngine);
+    runner.run();
 
-    auto defaultEngine = default_random_engine{rd()};
-    cout << timed::calls("default_random_engine", iterations, defaultEngine) << endl;
+    if(!jsonFile.empty()) {
+        ofstream out(jsonFile);
+        runner.write_json(out, argv[0]);
+    }
 
     return 0;
 }
@@ -0,0 +1,307 @@
+#include "../include/tesuji/timed.hpp"
+#include "../include/tesuji/tracked_allocator.hpp"
+using namespace tesuji;
+
+#if defined(__has_include) && __has_include(<CLI/CLI.hpp>)
+#    include <CLI/CLI.hpp>
+#else
+#    pragma message("Consider getting https://github.com/CLIUtils/CLI11")
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <format>
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// container_explorer runs standard operations on the standard containers and
+// prints what each cost: the copies and moves of the elements, the
+// allocations of the container and the time.
+//
+// Counts come from a run with tracked::value<std::string> elements and a
+// tracked::counting_allocator. Times come from separate runs with plain
+// std::string elements and std::allocator, repeated for at least 10ms, so the
+// counting doesn't show in them. The strings are 24 characters, too long for
+// the small string buffer, so a copy allocates and a move doesn't.
+///////////////////////////////////////////////////////////////////////////////
+
+using tracked_string = tracked::value<string>;
+
+template<typename E> using vector_of = vector<E, tracked::counting_allocator<E>>;
+template<typename E> using deque_of  = deque<E, tracked::counting_allocator<E>>;
+template<typename E> using list_of   = list<E, tracked::counting_allocator<E>>;
+template<typename E>
+using map_of = map<int, E, less<>, tracked::counting_allocator<pair<const int, E>>>;
+template<typename E>
+using unordered_map_of = unordered_map<int, E, hash<int>, equal_to<>,
+                                       tracked::counting_allocator<pair<const int, E>>>;
+
+// the same containers for timing
+template<typename E> using plain_vector        = vector<E>;
+template<typename E> using plain_deque         = deque<E>;
+template<typename E> using plain_list          = list<E>;
+template<typename E> using plain_map           = map<int, E>;
+template<typename E> using plain_unordered_map = unordered_map<int, E>;
+
+
+// Made once, so that formatting doesn't show in the times.
+const string &element(size_t i) {
+    static const vector<string> elements = [] {
+        vector<string> result;
+        for(size_t i = 0; i < 4096; ++i) {
+            result.push_back(format("{:024}", (i * 2654435761u) % 1000003));
+        }
+        return result;
+    }();
+    return elements[i % elements.size()];
+}
+
+
+// Keys 0..n-1 in a fixed random order, made once per n, so that shuffling doesn't show in the
+// times either.
+const vector<int> &shuffled_keys(size_t n) {
+    static map<size_t, vector<int>> cache;
+
+    vector<int> &keys = cache[n];
+    if(keys.size() != n) {
+        keys.resize(n);
+        for(size_t i = 0; i < n; ++i) {
+            keys[i] = int(i);
+        }
+        shuffle(keys.begin(), keys.end(), mt19937(42));
+    }
+    return keys;
+}
+
+
+struct row
+{
+    tracked::lifecycle_counts  elements;
+    tracked::allocation_counts allocations;
+    chrono::nanoseconds        time{}; // of one run
+    size_t                     ops = 0;
+};
+
+
+// `setup` prepares a container of size n untimed and uncounted, `op` runs the operation and returns
+// how many element operations it did.
+template<template<typename> typename Tracked, template<typename> typename Plain, typename Setup,
+         typename Op>
+row measure(size_t n, Setup setup, Op op) {
+    row r;
+    {
+        Tracked<tracked_string> c;
+        setup(c, n);
+        const auto before      = tracked::take_snapshot();
+        const auto allocBefore = c.get_allocator().counts();
+        r.ops                  = op(c, n);
+        r.elements = (tracked::take_snapshot() - before).of<tracked_string>();
+        const auto allocAfter = c.get_allocator().counts();
+        r.allocations.allocations = allocAfter.allocations - allocBefore.allocations;
+        r.allocations.bytes       = allocAfter.bytes - allocBefore.bytes;
+    }
+
+    chrono::nanoseconds total{};
+    size_t              runs = 0;
+    while(total < 10ms || runs < 3) {
+        Plain<string> c;
+        setup(c, n);
+        const auto start = chrono::steady_clock::now();
+        op(c, n);
+        total += chrono::steady_clock::now() - start;
+        ++runs;
+    }
+    r.time = total / runs;
+    return r;
+}
+
+
+void print_header() {
+    cout << format("{:<20} {:<14} {:>8} {:>10} {:>10} {:>8} {:>10} {:>10} {:>10}\n", "operation",
+                   "container", "n", "copies", "moves", "allocs", "bytes", "time", "per op");
+}
+
+
+void print(string_view operation, string_view container, size_t n, const row &r) {
+    const auto perOp = r.time / int64_t(max<size_t>(r.ops, 1));
+    cout << format("{:<20} {:<14} {:>8} {:>10} {:>10} {:>8} {:>10} {:>10} {:>10}\n", operation,
+                   container, n, r.elements.copies(), r.elements.moves(),
+                   r.allocations.allocations, tracked::bytesToHumanString(r.allocations.bytes),
+                   timed::durationToHumanString(r.time), timed::durationToHumanString(perOp));
+}
+
+
+// Operations for the sequence containers.
+constexpr size_t middleOps = 100;
+
+auto noSetup = [](auto &, size_t) {};
+
+auto fillSequence = [](auto &c, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        c.push_back(element(i));
+    }
+};
+
+auto reserveOnly = [](auto &c, size_t n) {
+    c.reserve(n);
+};
+
+auto pushBack = [](auto &c, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        c.push_back(element(i));
+    }
+    return n;
+};
+
+auto insertMiddle = [](auto &c, size_t) {
+    for(size_t i = 0; i < middleOps; ++i) {
+        c.insert(next(c.begin(), ptrdiff_t(c.size() / 2)), element(i));
+    }
+    return middleOps;
+};
+
+auto eraseMiddle = [](auto &c, size_t) {
+    size_t i = 0;
+    for(; i < middleOps && !c.empty(); ++i) {
+        c.erase(next(c.begin(), ptrdiff_t(c.size() / 2)));
+    }
+    return i;
+};
+
+auto sortAll = [](auto &c, size_t n) {
+    if constexpr(requires { c.sort(); }) {
+        c.sort();
+    } else {
+        sort(c.begin(), c.end());
+    }
+    return n;
+};
+
+auto fillShuffled = [](auto &c, size_t n) {
+    for(int key: shuffled_keys(n)) {
+        c.push_back(element(size_t(key)));
+    }
+};
+
+
+// Operations for the associative containers.
+auto insertShuffled = [](auto &c, size_t n) {
+    for(int key: shuffled_keys(n)) {
+        c.insert({key, element(size_t(key))});
+    }
+    return n;
+};
+
+auto emplaceShuffled = [](auto &c, size_t n) {
+    for(int key: shuffled_keys(n)) {
+        c.emplace(key, element(size_t(key)));
+    }
+    return n;
+};
+
+auto insertSorted = [](auto &c, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        c.insert({int(i), element(i)});
+    }
+    return n;
+};
+
+auto emplaceHintSorted = [](auto &c, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        c.emplace_hint(c.end(), int(i), element(i));
+    }
+    return n;
+};
+
+auto fillMap = [](auto &c, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        c.emplace(int(i), element(i));
+    }
+};
+
+auto rehash = [](auto &c, size_t n) {
+    c.rehash(4 * n);
+    return n;
+};
+
+
+int main(int argc, char **argv) {
+    size_t maxSize = 100000;
+
+#if defined(CLI11_VERSION)
+    CLI::App app{"copies, moves, allocations and time of std container operations"};
+    app.add_option("-n,--max-size", maxSize, "largest container size, sizes grow by 10x from 10")
+        ->default_str(to_string(maxSize));
+    CLI11_PARSE(app, argc, argv);
+#else
+    if(argc > 1) {
+        maxSize = stoul(argv[1]);
+    }
+#endif
+
+    tracked::set_silent();
+    tracked::set_copy_audit(false);
+
+    vector<size_t> sizes;
+    for(size_t n = 10; n <= maxSize; n *= 10) {
+        sizes.push_back(n);
+    }
+
+    print_header();
+    for(size_t n: sizes) {
+        print("push_back", "vector", n, measure<vector_of, plain_vector>(n, noSetup, pushBack));
+        print("push_back reserved", "vector", n,
+              measure<vector_of, plain_vector>(n, reserveOnly, pushBack));
+        print("push_back", "deque", n, measure<deque_of, plain_deque>(n, noSetup, pushBack));
+        print("push_back", "list", n, measure<list_of, plain_list>(n, noSetup, pushBack));
+    }
+    for(size_t n: sizes) {
+        print("insert middle", "vector", n,
+              measure<vector_of, plain_vector>(n, fillSequence, insertMiddle));
+        print("insert middle", "deque", n,
+              measure<deque_of, plain_deque>(n, fillSequence, insertMiddle));
+        print("insert middle", "list", n,
+              measure<list_of, plain_list>(n, fillSequence, insertMiddle));
+    }
+    for(size_t n: sizes) {
+        print("erase middle", "vector", n,
+              measure<vector_of, plain_vector>(n, fillSequence, eraseMiddle));
+        print("erase middle", "deque", n,
+              measure<deque_of, plain_deque>(n, fillSequence, eraseMiddle));
+        print("erase middle", "list", n,
+              measure<list_of, plain_list>(n, fillSequence, eraseMiddle));
+    }
+    for(size_t n: sizes) {
+        print("sort", "vector", n, measure<vector_of, plain_vector>(n, fillShuffled, sortAll));
+        print("sort", "deque", n, measure<deque_of, plain_deque>(n, fillShuffled, sortAll));
+        print("sort", "list", n, measure<list_of, plain_list>(n, fillShuffled, sortAll));
+    }
+    for(size_t n: sizes) {
+        print("insert", "map", n, measure<map_of, plain_map>(n, noSetup, insertShuffled));
+        print("emplace", "map", n, measure<map_of, plain_map>(n, noSetup, emplaceShuffled));
+        print("insert sorted", "map", n, measure<map_of, plain_map>(n, noSetup, insertSorted));
+        print("emplace_hint sorted", "map", n,
+              measure<map_of, plain_map>(n, noSetup, emplaceHintSorted));
+    }
+    for(size_t n: sizes) {
+        print("insert", "unordered_map", n,
+              measure<unordered_map_of, plain_unordered_map>(n, noSetup, insertShuffled));
+        print("emplace", "unordered_map", n,
+              measure<unordered_map_of, plain_unordered_map>(n, noSetup, emplaceShuffled));
+        print("insert reserved", "unordered_map", n,
+              measure<unordered_map_of, plain_unordered_map>(n, reserveOnly, insertShuffled));
+        print("rehash", "unordered_map", n,
+              measure<unordered_map_of, plain_unordered_map>(n, fillMap, rehash));
+    }
+
+    return 0;
+}
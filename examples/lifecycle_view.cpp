@@ -0,0 +1,360 @@
+#include "../include/tesuji/timed.hpp"
+#include "../include/tesuji/tracked.hpp"
+using namespace tesuji;
+
+#if defined(__has_include) && __has_include(<CLI/CLI.hpp>)
+#    include <CLI/CLI.hpp>
+#else
+#    pragma message("Consider getting https://github.com/CLIUtils/CLI11")
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// lifecycle_view reads an event log of tracked::start_event_log(), rebuilds
+// the lifetime of every object, prints the objects per type, the longest copy
+// chains and the most copied objects, and renders a lifetime chart as SVG.
+//
+//      lifecycle_view lifecycle.bin --svg lifetimes.svg
+///////////////////////////////////////////////////////////////////////////////
+
+using tracked::lifecycle_event;
+using tracked::lifecycle_record;
+
+
+struct lifetime
+{
+    uint64_t        address;
+    uint16_t        type;
+    uint32_t        thread;
+    int64_t         start;
+    int64_t         end = -1; // -1 while alive
+    lifecycle_event origin;
+    int64_t         source   = -1; // lifetime copied or moved from
+    uint32_t        depth    = 0;  // copies from the first object of the chain
+    uint32_t        copies   = 0;  // made from this object, by construction or assignment
+    uint32_t        moves    = 0;
+    uint32_t        assigned = 0;
+};
+
+
+struct type_summary
+{
+    uint64_t        objects     = 0;
+    uint64_t        copies      = 0;
+    uint64_t        moves       = 0;
+    uint64_t        alive       = 0;
+    uint64_t        allocations = 0;
+    uint64_t        bytes       = 0;
+    vector<int64_t> lifetimes;
+};
+
+
+bool read_log(const string &path, vector<lifecycle_record> &records, vector<string> &names) {
+    ifstream in(path, ios::binary);
+    char     magic[sizeof(tracked::event_log_magic)];
+    uint32_t header[2];
+    if(!in.read(magic, sizeof(magic)) || memcmp(magic, tracked::event_log_magic, sizeof(magic)) != 0
+       || !in.read((char *)header, sizeof(header)) || header[0] != sizeof(lifecycle_record)) {
+        cerr << path << ": not a lifecycle event log\n";
+        return false;
+    }
+
+    lifecycle_record record;
+    while(in.read((char *)&record, sizeof(record))) {
+        if(record.event != lifecycle_event::end) {
+            records.push_back(record);
+            continue;
+        }
+        for(uint64_t i = 0; i < record.object; ++i) {
+            uint32_t length = 0;
+            in.read((char *)&length, sizeof(length));
+            string name(length, '\0');
+            in.read(name.data(), length);
+            names.push_back(std::move(name));
+        }
+        return true;
+    }
+    cerr << path << ": no end record, the log wasn't stopped, types are unnamed\n";
+    return true;
+}
+
+
+vector<lifetime> rebuild(vector<lifecycle_record> &records, vector<type_summary> &types) {
+    // buffers of different threads are written in any order
+    stable_sort(records.begin(), records.end(),
+                [](const auto &lhs, const auto &rhs) { return lhs.time < rhs.time; });
+
+    vector<lifetime>                lifetimes;
+    unordered_map<uint64_t, size_t> open; // by address and type
+
+    auto key  = [](uint64_t address, uint16_t type) { return (address << 16) | type; };
+    auto find = [&](uint64_t address, uint16_t type) -> lifetime * {
+        auto it = open.find(key(address, type));
+        return it == open.end() ? nullptr : &lifetimes[it->second];
+    };
+
+    for(const lifecycle_record &r: records) {
+        if(r.type >= types.size()) {
+            types.resize(r.type + 1);
+        }
+        type_summary &summary = types[r.type];
+
+        switch(r.event) {
+        case lifecycle_event::default_construction:
+        case lifecycle_event::construction:
+        case lifecycle_event::copy_construction:
+        case lifecycle_event::move_construction: {
+            if(lifetime *previous = find(r.object, r.type)) {
+                previous->end = r.time; // its destruction wasn't logged
+            }
+            lifetime l{r.object, r.type, r.thread, r.time, -1, r.event};
+            const bool copy = r.event == lifecycle_event::copy_construction;
+            if(copy || r.event == lifecycle_event::move_construction) {
+                if(lifetime *source = find(r.other, r.type)) {
+                    l.source = source - lifetimes.data();
+                    l.depth  = source->depth + copy;
+                    ++(copy ? source->copies : source->moves);
+                }
+                ++(copy ? summary.copies : summary.moves);
+            }
+            open[key(r.object, r.type)] = lifetimes.size();
+            lifetimes.push_back(l);
+            ++summary.objects;
+            break;
+        }
+        case lifecycle_event::copy_assignment:
+        case lifecycle_event::move_assignment: {
+            const bool copy = r.event == lifecycle_event::copy_assignment;
+            if(lifetime *target = find(r.object, r.type)) {
+                ++target->assigned;
+            }
+            if(lifetime *source = find(r.other, r.type)) {
+                ++(copy ? source->copies : source->moves);
+            }
+            ++(copy ? summary.copies : summary.moves);
+            break;
+        }
+        case lifecycle_event::destruction:
+            if(auto it = open.find(key(r.object, r.type)); it != open.end()) {
+                lifetime &l = lifetimes[it->second];
+                l.end       = r.time;
+                summary.lifetimes.push_back(l.end - l.start);
+                open.erase(it);
+            }
+            break;
+        case lifecycle_event::allocation:
+            ++summary.allocations;
+            summary.bytes += r.other;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for(const auto &[k, index]: open) {
+        ++types[lifetimes[index].type].alive;
+    }
+    return lifetimes;
+}
+
+
+string duration(int64_t ns) {
+    return timed::durationToHumanString(chrono::nanoseconds(ns));
+}
+
+
+string xml_escape(string_view text) {
+    string result;
+    for(char c: text) {
+        switch(c) {
+        case '<': result += "&lt;"; break;
+        case '>': result += "&gt;"; break;
+        case '&': result += "&amp;"; break;
+        case '"': result += "&quot;"; break;
+        default: result += c;
+        }
+    }
+    return result;
+}
+
+
+void print_summary(const vector<type_summary> &types, const vector<string> &names) {
+    cout << "objects by type:\n";
+    for(size_t t = 0; t < types.size(); ++t) {
+        auto s = types[t];
+        if(s.objects == 0 && s.allocations == 0) {
+            continue;
+        }
+        sort(s.lifetimes.begin(), s.lifetimes.end());
+        const bool   none    = s.lifetimes.empty();
+        const string median  = none ? "-" : duration(s.lifetimes[s.lifetimes.size() / 2]);
+        const string longest = none ? "-" : duration(s.lifetimes.back());
+        cout << format("    {}: {} objects, {} copies, {} moves, lifetime median: {}, max: {}, "
+                       "alive at the end: {}",
+                       t < names.size() ? names[t] : format("type {}", t), s.objects, s.copies,
+                       s.moves, median, longest, s.alive);
+        if(s.allocations > 0) {
+            cout << format(", new: {} with {} bytes", s.allocations, s.bytes);
+        }
+        cout << "\n";
+    }
+}
+
+
+void print_chains(const vector<lifetime> &lifetimes, const vector<string> &names, size_t top) {
+    auto name = [&](const lifetime &l) {
+        return l.type < names.size() ? names[l.type] : format("type {}", l.type);
+    };
+    auto how = [](lifecycle_event e) {
+        switch(e) {
+        case lifecycle_event::copy_construction: return "copy";
+        case lifecycle_event::move_construction: return "move";
+        case lifecycle_event::default_construction: return "default";
+        default: return "constructed";
+        }
+    };
+
+    vector<size_t> order(lifetimes.size());
+    for(size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    // the ends of the chains, the objects that were copied themselves are part of a longer chain
+    vector<size_t> ends;
+    copy_if(order.begin(), order.end(), back_inserter(ends),
+            [&](size_t i) { return lifetimes[i].depth > 0 && lifetimes[i].copies == 0; });
+    stable_sort(ends.begin(), ends.end(), [&](size_t lhs, size_t rhs) {
+        return lifetimes[lhs].depth > lifetimes[rhs].depth;
+    });
+    cout << "longest copy chains:\n";
+    for(size_t i = 0; i < min(top, ends.size()); ++i) {
+        vector<size_t> chain;
+        for(int64_t l = int64_t(ends[i]); l >= 0; l = lifetimes[l].source) {
+            chain.push_back(size_t(l));
+        }
+        const lifetime &first = lifetimes[chain.back()];
+        cout << format("    {}: {} copies: #{} ({} at {})", name(first), lifetimes[ends[i]].depth,
+                       chain.back(), how(first.origin), duration(first.start));
+        for(auto it = chain.rbegin() + 1; it != chain.rend(); ++it) {
+            const lifetime &l = lifetimes[*it];
+            cout << format(" -{}-> #{} ({})", how(l.origin), *it, duration(l.start));
+        }
+        cout << "\n";
+    }
+
+    stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return lifetimes[lhs].copies > lifetimes[rhs].copies;
+    });
+    cout << "most copied objects:\n";
+    for(size_t i = 0; i < min(top, order.size()) && lifetimes[order[i]].copies > 0; ++i) {
+        const lifetime &l = lifetimes[order[i]];
+        cout << format("    {}#{}: {} copies, {} moves, thread {}, lived {}\n", name(l), order[i],
+                       l.copies, l.moves, l.thread,
+                       l.end < 0 ? string("until the end") : duration(l.end - l.start));
+    }
+}
+
+
+// One row per object, the first `maxObjects` by construction time, and a line from the source of
+// every copy (red) and move (blue) to its target.
+void write_svg(ostream &os, const vector<lifetime> &lifetimes, const vector<string> &names,
+               size_t maxObjects) {
+    static constexpr const char *colors[] = {"#4e79a7", "#f28e2b", "#59a14f", "#b07aa1",
+                                             "#edc948", "#76b7b2", "#ff9da7", "#9c755f"};
+    constexpr double width = 1200, left = 10, rowHeight = 6, legendHeight = 20;
+
+    const size_t rows = min(maxObjects, lifetimes.size());
+    int64_t      last = 1;
+    for(const lifetime &l: lifetimes) {
+        last = max({last, l.start, l.end});
+    }
+    auto x = [&](int64_t t) { return left + (width - 2 * left) * double(t) / double(last); };
+    auto y = [&](size_t row) { return legendHeight * double(names.size() + 1) + rowHeight * row; };
+
+    os << format("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{}\" height=\"{}\" "
+                 "font-family=\"sans-serif\" font-size=\"12\">\n",
+                 width, y(rows) + rowHeight);
+    for(size_t t = 0; t < names.size(); ++t) {
+        os << format("<rect x=\"{}\" y=\"{}\" width=\"12\" height=\"12\" fill=\"{}\"/>"
+                     "<text x=\"{}\" y=\"{}\">{}</text>\n",
+                     left, legendHeight * t, colors[t % size(colors)], left + 16,
+                     legendHeight * t + 11, xml_escape(names[t]));
+    }
+    os << format("<text x=\"{}\" y=\"{}\">0 to {}, {} of {} objects</text>\n", left,
+                 legendHeight * names.size() + 11, duration(last), rows, lifetimes.size());
+
+    for(size_t i = 0; i < rows; ++i) {
+        const lifetime &l   = lifetimes[i];
+        const int64_t   end = l.end < 0 ? last : l.end;
+        os << format("<rect x=\"{:.1f}\" y=\"{:.1f}\" width=\"{:.1f}\" height=\"{}\" fill=\"{}\">"
+                     "<title>{}#{} thread {}: {}</title></rect>\n",
+                     x(l.start), y(i), max(x(end) - x(l.start), 1.0), rowHeight - 1,
+                     colors[l.type % size(colors)],
+                     l.type < names.size() ? xml_escape(names[l.type]) : "?", i,
+                     l.thread, l.end < 0 ? string("alive at the end") : duration(end - l.start));
+        if(l.source >= 0 && size_t(l.source) < rows) {
+            const bool copy = l.origin == lifecycle_event::copy_construction;
+            os << format("<line x1=\"{0:.1f}\" y1=\"{1:.1f}\" x2=\"{0:.1f}\" y2=\"{2:.1f}\" "
+                         "stroke=\"{3}\" stroke-width=\"1\"/>\n",
+                         x(l.start), y(size_t(l.source)) + rowHeight / 2, y(i) + rowHeight / 2,
+                         copy ? "#d62728" : "#1f77b4");
+        }
+    }
+    os << "</svg>\n";
+}
+
+
+int main(int argc, char **argv) {
+    string logFile = "lifecycle.bin";
+    string svgFile;
+    size_t top        = 10;
+    size_t maxObjects = 2000;
+
+#if defined(CLI11_VERSION)
+    CLI::App app{"object lifetimes from a tracked event log"};
+    app.add_option("log", logFile, "file written by tracked::start_event_log()")
+        ->default_str(logFile);
+    app.add_option("-s,--svg", svgFile, "write a lifetime chart to this file");
+    app.add_option("-t,--top", top, "number of chains and objects to list")
+        ->default_str(to_string(top));
+    app.add_option("-m,--max-objects", maxObjects, "number of objects in the chart")
+        ->default_str(to_string(maxObjects));
+    CLI11_PARSE(app, argc, argv);
+#else
+    if(argc > 1) {
+        logFile = argv[1];
+    }
+    if(argc > 2) {
+        svgFile = argv[2];
+    }
+#endif
+
+    vector<lifecycle_record> records;
+    vector<string>           names;
+    if(!read_log(logFile, records, names)) {
+        return 1;
+    }
+
+    vector<type_summary> types(names.size());
+    const auto           lifetimes = rebuild(records, types);
+    cout << format("{}: {} events, {} objects\n", logFile, records.size(), lifetimes.size());
+    print_summary(types, names);
+    print_chains(lifetimes, names, top);
+
+    if(!svgFile.empty()) {
+        ofstream out(svgFile);
+        write_svg(out, lifetimes, names, maxObjects);
+    }
+
+    return 0;
+}
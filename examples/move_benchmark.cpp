@@ -0,0 +1,154 @@
+#include "../include/tesuji/benchmark.hpp"
+#include "../include/tesuji/tracked.hpp"
+using namespace tesuji;
+
+#if defined(__has_include) && __has_include(<CLI/CLI.hpp>)
+#    include <CLI/CLI.hpp>
+#else
+#    pragma message("Consider getting https://github.com/CLIUtils/CLI11")
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// move_benchmark measures what a throwing move constructor costs a growing
+// vector, which copies the elements instead, and what memcpy relocation saves
+// over moving and destroying. The element types differ only in how they
+// declare their moves, see tracked::value<T, NothrowMove, Relocatable>. Both
+// sides of a comparison pay the same for counting their moves and copies.
+///////////////////////////////////////////////////////////////////////////////
+
+using noexcept_string = tracked::value<string>;
+using throwing_string = tracked::value<string, false>;
+
+
+// Owns its memory through a pointer, so memcpy moves it just fine.
+struct buffer
+{
+    unique_ptr<char[]> data;
+    size_t             size = 0;
+};
+
+template<> struct tracked::is_trivially_relocatable<buffer> : true_type
+{};
+
+using relocatable_buffer = tracked::value<buffer>;
+using movable_buffer     = tracked::value<buffer, true, false>;
+
+
+template<typename T> void grow(size_t n) {
+    vector<T> v;
+    for(size_t i = 0; i < n; ++i) {
+        v.emplace_back("longer than the small string buffer");
+    }
+}
+
+
+// n buffers that move between two arrays, like the elements of a vector that grows.
+template<typename T> struct relocation
+{
+    allocator<T> alloc;
+    size_t       n;
+    T           *from;
+    T           *to;
+
+    explicit relocation(size_t count)
+        : n(count)
+        , from(alloc.allocate(n))
+        , to(alloc.allocate(n)) {
+        for(size_t i = 0; i < n; ++i) {
+            construct_at(from + i, buffer{make_unique<char[]>(64), 64});
+        }
+    }
+
+    relocation(const relocation &) = delete;
+
+    ~relocation() {
+        destroy(from, from + n);
+        alloc.deallocate(from, n);
+        alloc.deallocate(to, n);
+    }
+
+    void operator()() {
+        tracked::relocate(from, from + n, to);
+        swap(from, to);
+    }
+};
+
+
+template<typename T> void print_counts(string_view label, auto &&func) {
+    const auto before = tracked::take_snapshot();
+    func();
+    const auto counts = (tracked::take_snapshot() - before).of<T>();
+    cout << format("{:<20} copies: {:>8}, moves: {:>8}\n", label, counts.copies(), counts.moves());
+}
+
+
+int main(int argc, char **argv) {
+    size_t elements    = 10000;
+    size_t iterations  = 1000;
+    size_t repetitions = 1;
+    string jsonFile;
+
+#if defined(CLI11_VERSION)
+    CLI::App app{"throwing and noexcept moves, relocation and move and destroy"};
+    app.add_option("-n,--elements", elements, "elements per vector")
+        ->default_str(to_string(elements));
+    app.add_option("-i,--iterations", iterations, "maximum number of iterations")
+        ->default_str(to_string(iterations));
+    app.add_option("-r,--repetitions", repetitions, "number of repetitions")
+        ->default_str(to_string(repetitions));
+    app.add_option("-j,--json", jsonFile, "write Google Benchmark compatible JSON to this file");
+    CLI11_PARSE(app, argc, argv);
+#else
+    if(argc > 1) {
+        elements = stoul(argv[1]);
+    }
+    if(argc > 2) {
+        iterations = stoul(argv[2]);
+    }
+#endif
+
+    tracked::set_silent();
+    tracked::set_copy_audit(false);
+
+    relocation<relocatable_buffer> relocatable(elements);
+    relocation<movable_buffer>     movable(elements);
+
+    // one counted run each, the copies of the throwing moves are reported at exit
+    print_counts<noexcept_string>("noexcept_string", [=] { grow<noexcept_string>(elements); });
+    print_counts<throwing_string>("throwing_string", [=] { grow<throwing_string>(elements); });
+    print_counts<relocatable_buffer>("relocatable_buffer", relocatable);
+    print_counts<movable_buffer>("movable_buffer", movable);
+    tracked::set_move_diagnostics(false);
+    cout << "\n";
+
+    const timed::stop_rule rule{
+        .max_count = iterations,
+        .min_time  = 100ms,
+        .max_time  = 10s,
+        .precision = 0.01,
+    };
+
+    timed::benchmark_runner runner;
+    runner.repetitions = repetitions;
+    runner.add("grow_noexcept_move", rule, [=] { grow<noexcept_string>(elements); });
+    runner.add("grow_throwing_move", rule, [=] { grow<throwing_string>(elements); });
+    runner.add("relocate_memcpy", rule, relocatable);
+    runner.add("relocate_move_destroy", rule, movable);
+    runner.run();
+
+    if(!jsonFile.empty()) {
+        ofstream out(jsonFile);
+        runner.write_json(out, argv[0]);
+    }
+
+    return 0;
+}
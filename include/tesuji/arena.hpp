@@ -0,0 +1,788 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__has_include) && __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#    include <sys/mman.h>
+#    include <unistd.h>
+#    define TESUJI_HAS_MMAP 1
+#else
+#    define TESUJI_HAS_MMAP 0
+#endif
+
+
+namespace tesuji {
+
+// Provides two memory resources that take allocations off the heap, and an allocator for both.
+//      struct arena; // bump allocator in chained chunks, frees everything at once with reset()
+//      struct pool;  // blocks of one size on a free list, optionally with per-thread caches
+//      template<typename T, typename Resource> struct resource_allocator;
+//      std::vector<std::pair<std::string, resource_stats>> resource_totals();
+//
+// Provides two more for comparing and debugging, e.g. as the backing of tracked::B and D.
+//      std::pmr::memory_resource *malloc_resource(); // malloc and free
+//      struct page_resource; // pages per allocation, ending at a guard page
+//
+// All are `std::pmr::memory_resource`s, so `std::pmr` containers take them directly. The
+// `resource_allocator` calls them without the virtual call of `std::pmr::polymorphic_allocator`
+// and does not propagate itself to the elements.
+//
+// An arena hands out memory by bumping a pointer through a chunk it got from its upstream
+// resource, deallocate does nothing. When a chunk is full the next one is chained to it, each twice
+// the size of the one before up to 64 times the first. `reset()` rewinds to the first chunk and
+// keeps them all, so a request loop that resets its arena stops allocating from upstream after the
+// first few requests. An arena is not thread safe.
+//
+// A pool carves chunks of `blocks_per_chunk` blocks and keeps freed blocks on a free list. Larger
+// or more aligned requests than its block size go to the upstream resource. The free list is
+// guarded by a mutex. With `thread_cache` every thread keeps up to `cache_size` blocks of its own
+// and only locks to exchange half of them, which keeps threads that allocate and free many small
+// objects from contending.
+//
+// Every resource counts its allocations and the chunks it took from upstream under its name.
+// `resource_totals()` sums them by name, including resources already destroyed, and
+// `tracked::heap_report()` lists them as the allocations that never reached operator new.
+//
+// Example:
+//      tesuji::arena scratch(64 * 1024, std::pmr::get_default_resource(), "request");
+//      for(const auto &request: requests) {
+//          std::pmr::vector<std::pmr::string> fields(&scratch);
+//          parse(request, fields);
+//          scratch.reset();
+//      }
+//      for(const auto &[name, stats]: tesuji::resource_totals()) {
+//          std::cout << name << ": " << stats << "\n";
+//      }
+// Possible output:
+//      request: allocations: 1200321, absorbed: 1200318, 96.1 MiB, upstream: 3 allocations,
+//      448.0 KiB
+//
+
+
+struct resource_stats
+{
+    uint64_t allocations          = 0;
+    uint64_t deallocations        = 0;
+    uint64_t bytes                = 0; // requested
+    uint64_t upstream_allocations = 0; // chunks and requests too large for the resource
+    uint64_t upstream_bytes       = 0;
+
+    // Allocations that did not reach the upstream resource.
+    uint64_t absorbed() const {
+        return allocations - std::min(allocations, upstream_allocations);
+    }
+
+    resource_stats &operator+=(const resource_stats &rhs) {
+        allocations          += rhs.allocations;
+        deallocations        += rhs.deallocations;
+        bytes                += rhs.bytes;
+        upstream_allocations += rhs.upstream_allocations;
+        upstream_bytes       += rhs.upstream_bytes;
+        return *this;
+    }
+
+    std::string to_string() const {
+        return std::format("allocations: {}, absorbed: {}, {:.1f} MiB, upstream: {} allocations, "
+                           "{:.1f} KiB",
+                           allocations, absorbed(), double(bytes) / (1 << 20),
+                           upstream_allocations, double(upstream_bytes) / 1024);
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const resource_stats &stats) {
+        return os << stats.to_string();
+    }
+};
+
+
+namespace detail {
+// Written by one thread only, so an increment needs no locked instruction, read by any.
+struct owned_counter
+{
+    std::atomic<uint64_t> value{0};
+
+    void add(uint64_t n) noexcept {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t load() const noexcept {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+
+// Resources that report their stats to the registry.
+struct counted_resource : std::pmr::memory_resource
+{
+    virtual resource_stats stats() const = 0;
+
+    const std::string &name() const {
+        return m_name;
+    }
+
+protected:
+    counted_resource(std::string_view name);
+
+    // Derived destructors call this while stats() still works.
+    void retire();
+
+    std::string m_name;
+};
+
+
+struct resource_registry
+{
+    std::mutex                                         mutex;
+    std::vector<const counted_resource *>              live;
+    std::map<std::string, resource_stats, std::less<>> retired;
+
+    static resource_registry &instance() {
+        static resource_registry registry;
+        return registry;
+    }
+};
+
+
+inline counted_resource::counted_resource(std::string_view name)
+    : m_name(name) {
+    auto           &registry = resource_registry::instance();
+    std::lock_guard lock(registry.mutex);
+    registry.live.push_back(this);
+}
+
+
+inline void counted_resource::retire() {
+    const resource_stats last     = stats();
+    auto                &registry = resource_registry::instance();
+    std::lock_guard      lock(registry.mutex);
+    std::erase(registry.live, this);
+    registry.retired[m_name] += last;
+}
+
+
+inline uintptr_t align_up(uintptr_t address, size_t alignment) {
+    return (address + alignment - 1) & ~uintptr_t(alignment - 1);
+}
+} // namespace detail
+
+
+namespace detail {
+// Over-aligned requests get aligned_alloc, which MSVC doesn't have.
+struct malloc_free_resource final : std::pmr::memory_resource
+{
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        void *p = nullptr;
+        if(alignment <= alignof(std::max_align_t)) {
+            p = std::malloc(bytes);
+        } else {
+#if defined(_MSC_VER)
+            p = _aligned_malloc(bytes, alignment);
+#else
+            p = std::aligned_alloc(alignment, align_up(bytes, alignment));
+#endif
+        }
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t, size_t alignment) override {
+#if defined(_MSC_VER)
+        if(alignment > alignof(std::max_align_t)) {
+            return _aligned_free(p);
+        }
+#endif
+        (void)alignment;
+        std::free(p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+} // namespace detail
+
+
+// The C heap as a memory resource. It is never destroyed, so objects may be freed during exit.
+inline std::pmr::memory_resource *malloc_resource() noexcept {
+    static auto *resource = new detail::malloc_free_resource;
+    return resource;
+}
+
+
+// The stats of all arenas and pools summed by name, including the destroyed ones.
+inline std::vector<std::pair<std::string, resource_stats>> resource_totals() {
+    auto           &registry = detail::resource_registry::instance();
+    std::lock_guard lock(registry.mutex);
+
+    std::map<std::string, resource_stats, std::less<>> totals = registry.retired;
+    for(const detail::counted_resource *resource: registry.live) {
+        totals[resource->name()] += resource->stats();
+    }
+    return {totals.begin(), totals.end()};
+}
+
+
+struct arena final : detail::counted_resource
+{
+    static constexpr size_t max_growth = 64;
+
+    explicit arena(size_t chunk_size = 64 * 1024,
+                   std::pmr::memory_resource *upstream = std::pmr::get_default_resource(),
+                   std::string_view name = "arena")
+        : counted_resource(name)
+        , m_chunkSize(std::max(chunk_size, sizeof(chunk) + alignof(std::max_align_t)))
+        , m_nextSize(m_chunkSize)
+        , m_upstream(upstream) {}
+
+    arena(const arena &)            = delete;
+    arena &operator=(const arena &) = delete;
+
+    ~arena() override {
+        retire();
+        release();
+    }
+
+    // Makes all memory available again and keeps the chunks. Everything allocated before is gone.
+    void reset() noexcept {
+        m_current = m_first;
+        start(m_current);
+    }
+
+    // Returns all chunks to the upstream resource.
+    void release() noexcept {
+        for(chunk *c = m_first; c;) {
+            chunk *next = c->next;
+            m_upstream->deallocate(c, c->size, alignof(chunk));
+            c = next;
+        }
+        m_first = m_current = m_last = nullptr;
+        m_cursor = m_end = 0;
+        m_nextSize       = m_chunkSize;
+    }
+
+    // Bytes in all chunks, used or not.
+    size_t capacity() const noexcept {
+        size_t bytes = 0;
+        for(const chunk *c = m_first; c; c = c->next) {
+            bytes += c->size - sizeof(chunk);
+        }
+        return bytes;
+    }
+
+    resource_stats stats() const override {
+        return {m_allocations.load(), m_deallocations.load(), m_bytes.load(),
+                m_upstreamAllocations.load(), m_upstreamBytes.load()};
+    }
+
+private:
+    struct chunk
+    {
+        chunk *next;
+        size_t size; // with this header
+    };
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        const uintptr_t p = detail::align_up(m_cursor, alignment);
+        // >= keeps a zero byte request from returning the null cursor of an arena without chunks
+        if(p < m_cursor || bytes >= m_end - std::min(p, m_end)) {
+            return allocate_slow(bytes, alignment);
+        }
+        m_cursor = p + bytes;
+        m_allocations.add(1);
+        m_bytes.add(bytes);
+        return reinterpret_cast<void *>(p);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {
+        m_deallocations.add(1); // freed by reset()
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    void start(chunk *c) noexcept {
+        m_cursor = c ? reinterpret_cast<uintptr_t>(c + 1) : 0;
+        m_end    = c ? reinterpret_cast<uintptr_t>(c) + c->size : 0;
+    }
+
+    [[gnu::noinline]] void *allocate_slow(size_t bytes, size_t alignment) {
+        const size_t needed = sizeof(chunk) + bytes + alignment;
+
+        // chunks kept by reset(), one too small for this request stays unused until the next reset
+        while(m_current && m_current->next) {
+            m_current = m_current->next;
+            start(m_current);
+            if(m_current->size >= needed) {
+                return do_allocate(bytes, alignment);
+            }
+        }
+
+        const size_t size = std::max(m_nextSize, needed);
+        auto        *c    = static_cast<chunk *>(m_upstream->allocate(size, alignof(chunk)));
+        *c                = {nullptr, size};
+        (m_last ? m_last->next : m_first) = c;
+        m_last = m_current = c;
+        start(c);
+        m_nextSize = std::min(m_nextSize * 2, m_chunkSize * max_growth);
+        m_upstreamAllocations.add(1);
+        m_upstreamBytes.add(size);
+        return do_allocate(bytes, alignment);
+    }
+
+    size_t                     m_chunkSize;
+    size_t                     m_nextSize;
+    std::pmr::memory_resource *m_upstream;
+    chunk                     *m_first   = nullptr;
+    chunk                     *m_current = nullptr;
+    chunk                     *m_last    = nullptr;
+    uintptr_t                  m_cursor  = 0;
+    uintptr_t                  m_end     = 0;
+
+    detail::owned_counter m_allocations;
+    detail::owned_counter m_deallocations;
+    detail::owned_counter m_bytes;
+    detail::owned_counter m_upstreamAllocations;
+    detail::owned_counter m_upstreamBytes;
+};
+
+
+struct pool_options
+{
+    size_t blocks_per_chunk = 256;
+    bool   thread_cache     = false;
+    size_t cache_size       = 64; // blocks per thread
+};
+
+
+namespace detail {
+struct pool_node
+{
+    pool_node *next;
+};
+
+
+struct pool_cache;
+
+
+// What the threads of a pool share. Caches keep it alive to return their blocks at thread exit,
+// those of a destroyed pool are dropped.
+struct pool_state
+{
+    std::mutex                 mutex;
+    bool                       alive = true;
+    pool_node                 *free  = nullptr;
+    std::vector<void *>        chunks;
+    std::vector<pool_cache *>  caches;
+    resource_stats             counts; // of the pool without cache, and of exited threads
+    size_t                     chunkBytes = 0;
+    size_t                     alignment  = 0;
+    std::pmr::memory_resource *upstream   = nullptr;
+
+    // Takes up to `n` blocks off the free list, carving a new chunk if it is empty.
+    pool_node *take(size_t n, size_t blockSize, size_t &taken) {
+        if(!free) {
+            auto *bytes = static_cast<std::byte *>(upstream->allocate(chunkBytes, alignment));
+            chunks.push_back(bytes);
+            for(size_t offset = chunkBytes; offset >= blockSize; offset -= blockSize) {
+                auto *node = reinterpret_cast<pool_node *>(bytes + offset - blockSize);
+                node->next = free;
+                free       = node;
+            }
+            ++counts.upstream_allocations;
+            counts.upstream_bytes += chunkBytes;
+        }
+        pool_node *first = free;
+        pool_node *last  = free;
+        for(taken = 1; taken < n && last->next; ++taken) {
+            last = last->next;
+        }
+        free       = last->next;
+        last->next = nullptr;
+        return first;
+    }
+
+    void give(pool_node *first, pool_node *last) {
+        last->next = free;
+        free       = first;
+    }
+};
+
+
+struct pool_cache
+{
+    std::shared_ptr<pool_state> state;
+    uint64_t                    pool  = 0; // id
+    pool_node                  *free  = nullptr;
+    size_t                      count = 0;
+    owned_counter               allocations;
+    owned_counter               deallocations;
+    owned_counter               bytes;
+
+    ~pool_cache() {
+        std::lock_guard lock(state->mutex);
+        if(state->alive && free) {
+            pool_node *last = free;
+            while(last->next) {
+                last = last->next;
+            }
+            state->give(free, last);
+        }
+        state->counts.allocations   += allocations.load();
+        state->counts.deallocations += deallocations.load();
+        state->counts.bytes         += bytes.load();
+        std::erase(state->caches, this);
+    }
+};
+
+
+// The caches of the calling thread, one per pool it used.
+struct pool_caches
+{
+    std::vector<std::unique_ptr<pool_cache>> caches;
+    pool_cache                              *last = nullptr;
+};
+
+inline thread_local pool_caches poolCaches;
+
+inline std::atomic<uint64_t> nextPoolId{1};
+} // namespace detail
+
+
+struct pool final : detail::counted_resource
+{
+    pool(size_t block_size, size_t alignment = alignof(std::max_align_t), pool_options options = {},
+         std::pmr::memory_resource *upstream = std::pmr::get_default_resource(),
+         std::string_view           name     = "pool")
+        : counted_resource(name)
+        , m_alignment(std::max(alignment, alignof(detail::pool_node)))
+        , m_blockSize(
+              detail::align_up(std::max(block_size, sizeof(detail::pool_node)), m_alignment))
+        , m_options(options)
+        , m_state(std::make_shared<detail::pool_state>()) {
+        m_options.blocks_per_chunk = std::max<size_t>(m_options.blocks_per_chunk, 1);
+        m_options.cache_size       = std::max<size_t>(m_options.cache_size, 2);
+        m_state->chunkBytes        = m_blockSize * m_options.blocks_per_chunk;
+        m_state->alignment         = m_alignment;
+        m_state->upstream          = upstream;
+    }
+
+    pool(const pool &)            = delete;
+    pool &operator=(const pool &) = delete;
+
+    // Frees all blocks, also those still cached by other threads.
+    ~pool() override {
+        retire();
+        std::lock_guard lock(m_state->mutex);
+        m_state->alive = false;
+        m_state->free  = nullptr;
+        for(void *chunk: m_state->chunks) {
+            m_state->upstream->deallocate(chunk, m_state->chunkBytes, m_alignment);
+        }
+        m_state->chunks.clear();
+    }
+
+    size_t block_size() const noexcept {
+        return m_blockSize;
+    }
+
+    resource_stats stats() const override {
+        std::lock_guard lock(m_state->mutex);
+        resource_stats  result = m_state->counts;
+        for(const detail::pool_cache *cache: m_state->caches) {
+            result.allocations   += cache->allocations.load();
+            result.deallocations += cache->deallocations.load();
+            result.bytes         += cache->bytes.load();
+        }
+        return result;
+    }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        if(bytes > m_blockSize || alignment > m_alignment) {
+            return allocate_upstream(bytes, alignment);
+        }
+        if(!m_options.thread_cache) {
+            std::lock_guard lock(m_state->mutex);
+            size_t          taken = 0;
+            ++m_state->counts.allocations;
+            m_state->counts.bytes += bytes;
+            return m_state->take(1, m_blockSize, taken);
+        }
+
+        detail::pool_cache &cache = local_cache();
+        if(!cache.free) {
+            std::lock_guard lock(m_state->mutex);
+            cache.free = m_state->take(m_options.cache_size / 2, m_blockSize, cache.count);
+        }
+        detail::pool_node *node = cache.free;
+        cache.free              = node->next;
+        --cache.count;
+        cache.allocations.add(1);
+        cache.bytes.add(bytes);
+        return node;
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        if(bytes > m_blockSize || alignment > m_alignment) {
+            return deallocate_upstream(p, bytes, alignment);
+        }
+        auto *node = static_cast<detail::pool_node *>(p);
+        if(!m_options.thread_cache) {
+            std::lock_guard lock(m_state->mutex);
+            ++m_state->counts.deallocations;
+            m_state->give(node, node);
+            return;
+        }
+
+        detail::pool_cache &cache = local_cache();
+        node->next                = cache.free;
+        cache.free                = node;
+        cache.deallocations.add(1);
+        if(++cache.count > m_options.cache_size) {
+            // keep half, give the rest back
+            detail::pool_node *last = cache.free;
+            for(size_t i = 1; i < m_options.cache_size / 2; ++i) {
+                last = last->next;
+            }
+            detail::pool_node *rest = last->next;
+            detail::pool_node *end  = rest;
+            while(end->next) {
+                end = end->next;
+            }
+            last->next  = nullptr;
+            cache.count = m_options.cache_size / 2;
+
+            std::lock_guard lock(m_state->mutex);
+            m_state->give(rest, end);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    detail::pool_cache &local_cache() {
+        auto &local = detail::poolCaches;
+        if(local.last && local.last->pool == m_id) {
+            return *local.last;
+        }
+        for(auto &cache: local.caches) {
+            if(cache->pool == m_id) {
+                return *(local.last = cache.get());
+            }
+        }
+        return new_cache();
+    }
+
+    [[gnu::noinline]] detail::pool_cache &new_cache() {
+        auto &local = detail::poolCaches;
+        std::erase_if(local.caches, [](const auto &cache) {
+            std::lock_guard lock(cache->state->mutex);
+            return !cache->state->alive;
+        });
+
+        auto cache   = std::make_unique<detail::pool_cache>();
+        cache->state = m_state;
+        cache->pool  = m_id;
+        {
+            std::lock_guard lock(m_state->mutex);
+            m_state->caches.push_back(cache.get());
+        }
+        local.caches.push_back(std::move(cache));
+        return *(local.last = local.caches.back().get());
+    }
+
+    [[gnu::noinline]] void *allocate_upstream(size_t bytes, size_t alignment) {
+        void           *p = m_state->upstream->allocate(bytes, alignment);
+        std::lock_guard lock(m_state->mutex);
+        ++m_state->counts.allocations;
+        ++m_state->counts.upstream_allocations;
+        m_state->counts.bytes          += bytes;
+        m_state->counts.upstream_bytes += bytes;
+        return p;
+    }
+
+    void deallocate_upstream(void *p, size_t bytes, size_t alignment) {
+        m_state->upstream->deallocate(p, bytes, alignment);
+        std::lock_guard lock(m_state->mutex);
+        ++m_state->counts.deallocations;
+    }
+
+    size_t                              m_alignment;
+    size_t                              m_blockSize;
+    pool_options                        m_options;
+    std::shared_ptr<detail::pool_state> m_state;
+    uint64_t                            m_id = detail::nextPoolId.fetch_add(1);
+};
+
+
+// Gives every allocation pages of its own, followed by an inaccessible guard page, and places it so
+// that it ends where the guard page starts: writing past its end faults at once. Freed pages are
+// unmapped, with `keep_freed` they stay reserved and inaccessible instead, so that a use after free
+// faults too, at the cost of address space. Every allocation costs at least two pages and a few
+// system calls, and Linux allows about 65000 mappings per process. Without mmap, and for alignments
+// beyond a page, it forwards to `upstream` and guards nothing.
+struct page_resource final : detail::counted_resource
+{
+    explicit page_resource(bool keep_freed = false,
+                           std::pmr::memory_resource *upstream = std::pmr::get_default_resource(),
+                           std::string_view           name     = "pages")
+        : counted_resource(name)
+        , m_keepFreed(keep_freed)
+        , m_upstream(upstream) {}
+
+    page_resource(const page_resource &)            = delete;
+    page_resource &operator=(const page_resource &) = delete;
+
+    ~page_resource() override {
+        retire();
+    }
+
+    // Bytes mapped for live allocations, their guard pages included.
+    size_t mapped() const noexcept {
+        return m_mapped.load(std::memory_order_relaxed);
+    }
+
+    resource_stats stats() const override {
+        return {m_allocations.load(), m_deallocations.load(), m_bytes.load(),
+                m_allocations.load(), m_upstreamBytes.load()};
+    }
+
+private:
+    static size_t page_size() noexcept {
+#if TESUJI_HAS_MMAP
+        static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+        return size;
+#else
+        return 4096;
+#endif
+    }
+
+    // The pages before the guard page.
+    static size_t data_bytes(size_t bytes, size_t alignment) noexcept {
+        return detail::align_up(std::max<size_t>(bytes, 1) + alignment - 1, page_size());
+    }
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        const size_t data  = data_bytes(bytes, alignment);
+        const size_t total = data + page_size();
+#if TESUJI_HAS_MMAP
+        if(alignment > page_size()) {
+            return m_upstream->allocate(bytes, alignment);
+        }
+        void *base =
+            mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char *guard = static_cast<char *>(base) + data;
+        mprotect(guard, page_size(), PROT_NONE);
+        void *p = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(guard - bytes)
+                                           & ~uintptr_t(alignment - 1));
+#else
+        void *p = m_upstream->allocate(bytes, alignment);
+#endif
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        m_upstreamBytes.fetch_add(total, std::memory_order_relaxed);
+        m_mapped.fetch_add(total, std::memory_order_relaxed);
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        const size_t data  = data_bytes(bytes, alignment);
+        const size_t total = data + page_size();
+#if TESUJI_HAS_MMAP
+        if(alignment > page_size()) {
+            return m_upstream->deallocate(p, bytes, alignment);
+        }
+        // the allocation ends within alignment - 1 bytes before the guard page
+        char *guard = reinterpret_cast<char *>(
+            detail::align_up(reinterpret_cast<uintptr_t>(p) + bytes, page_size()));
+        char *base = guard - data;
+        if(m_keepFreed) {
+            madvise(base, data, MADV_DONTNEED);
+            mprotect(base, data, PROT_NONE);
+        } else {
+            munmap(base, total);
+        }
+#else
+        m_upstream->deallocate(p, bytes, alignment);
+#endif
+        m_deallocations.fetch_add(1, std::memory_order_relaxed);
+        m_mapped.fetch_sub(total, std::memory_order_relaxed);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    bool                       m_keepFreed;
+    std::pmr::memory_resource *m_upstream;
+
+    std::atomic<uint64_t> m_allocations{0};
+    std::atomic<uint64_t> m_deallocations{0};
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<uint64_t> m_upstreamBytes{0};
+    std::atomic<uint64_t> m_mapped{0};
+};
+
+
+// A standard allocator on an arena or a pool, the resource must outlive it. Copies allocate from
+// the same resource, containers keep it on copy, move and swap.
+template<typename T, typename Resource> struct resource_allocator
+{
+    using value_type = T;
+
+    Resource *resource;
+
+    resource_allocator(Resource &resource) noexcept
+        : resource(&resource) {}
+
+    template<typename U>
+    resource_allocator(const resource_allocator<U, Resource> &other) noexcept
+        : resource(other.resource) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template<typename U>
+    friend bool operator==(const resource_allocator                &lhs,
+                           const resource_allocator<U, Resource> &rhs) {
+        return lhs.resource == rhs.resource;
+    }
+};
+
+template<typename T> using arena_allocator = resource_allocator<T, arena>;
+template<typename T> using pool_allocator  = resource_allocator<T, pool>;
+
+
+} // namespace tesuji
+
+
+#undef TESUJI_HAS_MMAP
@@ -0,0 +1,766 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "timed.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <sys/wait.h>
+#    include <unistd.h>
+#    define TESUJI_HAS_FORK 1
+#else
+#    define TESUJI_HAS_FORK 0
+#endif
+
+
+namespace tesuji { namespace timed {
+
+// Provides a runner for a list of named benchmarks built on `timed::calls`. Each benchmark is run
+// `repetitions` times and printed to the console as it finishes. With more than one repetition the
+// mean, median and stddev aggregates are added.
+//      struct benchmark_runner;
+//
+// Provides the time of a call as the first one in a fresh process with cold caches, for tools
+// where startup latency matters.
+//      call_info cold_calls(std::string_view name, size_t runs, auto &&func);
+//
+// Benchmarks that share a process influence each other through heap state, warm caches and lazy
+// binding, so their order changes the results. The runner can fork a fresh child per benchmark or
+// per repetition (POSIX only, ignored elsewhere) which sends its results back over a pipe. With
+// `shuffle` the repetitions are interleaved: each round runs every benchmark once, in a random
+// order.
+//
+// Provides output in Google Benchmark's JSON format, so results can be fed to its `compare.py`
+// and to dashboards that consume it. The context block describes the host: CPUs, caches and load
+// average.
+//      struct benchmark_context;
+//      benchmark_context current_context(std::string_view executable = "");
+//      void write_json(std::ostream &os, const benchmark_context &ctx, const std::vector<...> &);
+//      void write_json(std::ostream &os, const call_info &info);
+//
+// Example:
+//      timed::benchmark_runner runner;
+//      runner.repetitions = 3;
+//      runner.isolation   = timed::benchmark_runner::isolate::per_repetition;
+//      runner.shuffle     = true;
+//      runner.add("mt19937_64", 1000000, mersenne);
+//      runner.add("knuth_b", {.min_time = 100ms, .precision = 0.01}, knuth);
+//      runner.add("minstd_rand", [&]() {
+//          auto info = timed::calls("minstd_rand", 1000000, minstd);
+//          info.counters["bytes_per_second"] = 4 / (info.avg.count() * 1e-9);
+//          return info;
+//      });
+//      runner.run();
+//      std::ofstream out("results.json");
+//      runner.write_json(out);
+// Possible output:
+//      mt19937_64     : total:  65ms, avg:  65ns, min:  43ns, max: 236µs, calls: 1000000
+//      ...
+//      mt19937_64_mean: total:  65ms, avg:  65ns, min:   0ns, max:   0ns, calls: 1000000
+//
+
+
+struct benchmark_context
+{
+    struct cache
+    {
+        std::string type; // "Data", "Instruction" or "Unified"
+        int         level{0};
+        uint64_t    size{0}; // bytes
+        int         num_sharing{0};
+    };
+
+    std::string        date;
+    std::string        host_name;
+    std::string        executable;
+    unsigned           num_cpus{0};
+    double             mhz_per_cpu{0};
+    bool               cpu_scaling_enabled{false};
+    std::vector<cache> caches;
+    std::vector<double> load_avg;
+    std::string        library_build_type;
+};
+
+
+namespace detail {
+inline std::string read_first_line(const std::string &path) {
+    std::ifstream in(path);
+    std::string   line;
+    std::getline(in, line);
+    return line;
+}
+
+
+// Counts the CPUs in a sysfs cpu list like "0-3,8,10-11".
+inline int count_cpu_list(const std::string &list) {
+    int                count = 0;
+    std::istringstream in(list);
+    std::string        range;
+    while(std::getline(in, range, ',')) {
+        if(range.empty()) {
+            continue;
+        }
+        auto dash = range.find('-');
+        if(dash == std::string::npos) {
+            ++count;
+        } else {
+            count += std::stoi(range.substr(dash + 1)) - std::stoi(range.substr(0, dash)) + 1;
+        }
+    }
+    return count;
+}
+
+
+inline std::string json_escape(std::string_view value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for(char c: value) {
+        switch(c) {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20) {
+                escaped += std::format("\\u{:04x}", int(c));
+            } else {
+                escaped += c;
+            }
+        }
+    }
+    return escaped;
+}
+
+
+// JSON has no inf or nan.
+inline std::string json_number(double value) {
+    return std::isfinite(value) ? std::format("{}", value) : std::string("null");
+}
+} // namespace detail
+
+
+inline benchmark_context current_context(std::string_view executable = "") {
+    benchmark_context ctx;
+
+    ctx.date = std::format("{:%FT%T}+00:00", std::chrono::floor<seconds>(
+                                                 std::chrono::system_clock::now()));
+    ctx.executable         = executable;
+    ctx.num_cpus           = std::thread::hardware_concurrency();
+#if defined(NDEBUG)
+    ctx.library_build_type = "release";
+#else
+    ctx.library_build_type = "debug";
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    char host[256] = {};
+    if(gethostname(host, sizeof(host) - 1) == 0) {
+        ctx.host_name = host;
+    }
+
+    double loads[3];
+    if(int n = getloadavg(loads, 3); n > 0) {
+        ctx.load_avg.assign(loads, loads + n);
+    }
+#endif
+
+#if defined(__linux__)
+    if(ctx.executable.empty()) {
+        std::error_code ec;
+        ctx.executable = std::filesystem::read_symlink("/proc/self/exe", ec).string();
+    }
+
+    const std::string cpu0 = "/sys/devices/system/cpu/cpu0/";
+    if(auto khz = detail::read_first_line(cpu0 + "cpufreq/cpuinfo_max_freq"); !khz.empty()) {
+        ctx.mhz_per_cpu = std::stod(khz) / 1000.0;
+    } else {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        for(std::string line; std::getline(cpuinfo, line);) {
+            if(line.starts_with("cpu MHz")) {
+                ctx.mhz_per_cpu = std::stod(line.substr(line.find(':') + 1));
+                break;
+            }
+        }
+    }
+
+    auto governor           = detail::read_first_line(cpu0 + "cpufreq/scaling_governor");
+    ctx.cpu_scaling_enabled = !governor.empty() && governor != "performance";
+
+    for(int index = 0;; ++index) {
+        const auto dir   = std::format("{}cache/index{}/", cpu0, index);
+        const auto level = detail::read_first_line(dir + "level");
+        if(level.empty()) {
+            break;
+        }
+
+        benchmark_context::cache c;
+        c.level       = std::stoi(level);
+        c.type        = detail::read_first_line(dir + "type");
+        c.num_sharing = detail::count_cpu_list(detail::read_first_line(dir + "shared_cpu_list"));
+
+        // sizes look like "32K" or "8192K"
+        auto size = detail::read_first_line(dir + "size");
+        if(!size.empty()) {
+            c.size = std::stoull(size);
+            switch(size.back()) {
+            case 'K': c.size <<= 10; break;
+            case 'M': c.size <<= 20; break;
+            case 'G': c.size <<= 30; break;
+            }
+        }
+        ctx.caches.push_back(c);
+    }
+#endif
+
+    return ctx;
+}
+
+
+// One entry of the "benchmarks" array. `real_time` and `cpu_time` are per iteration in ns.
+struct benchmark_record
+{
+    call_info   info;
+    std::string run_name;
+    std::string run_type{"iteration"}; // or "aggregate"
+    std::string aggregate_name{};      // "mean", "median" or "stddev" for aggregates
+    size_t      family_index{0};
+    size_t      repetitions{1};
+    size_t      repetition_index{0};
+};
+
+
+inline void write_json(std::ostream &os, const benchmark_record &record, size_t indent = 4) {
+    const auto        &info = record.info;
+    const std::string  pad(indent, ' ');
+    const double       n       = info.count == 0 ? 1.0 : double(info.count);
+    const double       real_ns = double(duration_cast<nanoseconds>(info.total).count()) / n;
+    const double       cpu_ns  = double(duration_cast<nanoseconds>(info.cpu).count()) / n;
+
+    os << pad << "{\n";
+    os << std::format("{}  \"name\": \"{}\",\n", pad, detail::json_escape(info.name));
+    os << std::format("{}  \"family_index\": {},\n", pad, record.family_index);
+    os << std::format("{}  \"per_family_instance_index\": 0,\n", pad);
+    os << std::format("{}  \"run_name\": \"{}\",\n", pad, detail::json_escape(record.run_name));
+    os << std::format("{}  \"run_type\": \"{}\",\n", pad, record.run_type);
+    os << std::format("{}  \"repetitions\": {},\n", pad, record.repetitions);
+    if(record.run_type == "aggregate") {
+        os << std::format("{}  \"threads\": 1,\n", pad);
+        os << std::format("{}  \"aggregate_name\": \"{}\",\n", pad, record.aggregate_name);
+        os << std::format("{}  \"aggregate_unit\": \"time\",\n", pad);
+    } else {
+        os << std::format("{}  \"repetition_index\": {},\n", pad, record.repetition_index);
+        os << std::format("{}  \"threads\": 1,\n", pad);
+    }
+    os << std::format("{}  \"iterations\": {},\n", pad, info.count);
+    os << std::format("{}  \"real_time\": {},\n", pad, detail::json_number(real_ns));
+    os << std::format("{}  \"cpu_time\": {},\n", pad, detail::json_number(cpu_ns));
+    for(const auto &[name, value]: info.counters) {
+        os << std::format("{}  \"{}\": {},\n", pad, detail::json_escape(name),
+                          detail::json_number(value));
+    }
+    if(info.ghz > 0) {
+        os << std::format("{}  \"cycles\": {},\n", pad, detail::json_number(info.cycles()));
+        os << std::format("{}  \"GHz\": {},\n", pad, detail::json_number(info.ghz));
+    }
+    if(info.ref_ghz > 0) {
+        os << std::format("{}  \"ref_cycles\": {},\n", pad,
+                          detail::json_number(info.ref_cycles()));
+    }
+    if(info.first > call_info::duration::zero()) {
+        os << std::format("{}  \"first_time\": {},\n", pad,
+                          duration_cast<nanoseconds>(info.first).count());
+    }
+    os << std::format("{}  \"time_unit\": \"ns\"\n", pad);
+    os << pad << "}";
+}
+
+
+// A single `calls` result as a standalone benchmark object.
+inline void write_json(std::ostream &os, const call_info &info) {
+    write_json(os, benchmark_record{info, info.name}, 0);
+    os << "\n";
+}
+
+
+inline void write_json(std::ostream                        &os,
+                       const benchmark_context             &ctx,
+                       const std::vector<benchmark_record> &records) {
+    using detail::json_escape;
+
+    os << "{\n  \"context\": {\n";
+    os << std::format("    \"date\": \"{}\",\n", json_escape(ctx.date));
+    os << std::format("    \"host_name\": \"{}\",\n", json_escape(ctx.host_name));
+    os << std::format("    \"executable\": \"{}\",\n", json_escape(ctx.executable));
+    os << std::format("    \"num_cpus\": {},\n", ctx.num_cpus);
+    os << std::format("    \"mhz_per_cpu\": {},\n", std::llround(ctx.mhz_per_cpu));
+    os << std::format("    \"cpu_scaling_enabled\": {},\n", ctx.cpu_scaling_enabled);
+    os << "    \"caches\": [";
+    for(size_t i = 0; i < ctx.caches.size(); ++i) {
+        const auto &c = ctx.caches[i];
+        os << std::format("{}\n      {{\"type\": \"{}\", \"level\": {}, \"size\": {}, "
+                          "\"num_sharing\": {}}}",
+                          i == 0 ? "" : ",", json_escape(c.type), c.level, c.size, c.num_sharing);
+    }
+    os << (ctx.caches.empty() ? "],\n" : "\n    ],\n");
+    os << "    \"load_avg\": [";
+    for(size_t i = 0; i < ctx.load_avg.size(); ++i) {
+        os << (i == 0 ? "" : ", ") << detail::json_number(ctx.load_avg[i]);
+    }
+    os << "],\n";
+    os << std::format("    \"library_build_type\": \"{}\"\n", ctx.library_build_type);
+    os << "  },\n  \"benchmarks\": [\n";
+    for(size_t i = 0; i < records.size(); ++i) {
+        write_json(os, records[i]);
+        os << (i + 1 < records.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n}\n";
+}
+
+
+namespace detail {
+// Line based transfer of call_infos from a benchmark child process, names are known to the parent:
+//      r <count> <total> <avg> <min> <max> <cpu> <median> <median_error> <overhead> <ghz>
+//        <ref_ghz> <cycles_per_ns> <ref_cycles_per_ns> <first> <warmup>
+//      c <value> <counter name>
+inline std::string serialize(const call_info &info) {
+    std::string out = std::format(
+        "r {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}\n", info.count, info.total.count(),
+        info.avg.count(), info.min.count(), info.max.count(), info.cpu.count(),
+        info.median.count(), info.median_error, info.overhead.count(), info.ghz, info.ref_ghz,
+        info.cycles_per_ns, info.ref_cycles_per_ns, info.first.count(), info.warmup);
+    for(const auto &[name, value]: info.counters) {
+        out += std::format("c {} {}\n", value, name);
+    }
+    return out;
+}
+
+
+inline std::vector<call_info> deserialize(const std::string &data) {
+    using rep = call_info::duration::rep;
+
+    std::vector<call_info> infos;
+    std::istringstream     in(data);
+    for(std::string line; std::getline(in, line);) {
+        std::istringstream fields(line.substr(std::min<size_t>(2, line.size())));
+        if(line.starts_with("r ")) {
+            rep   total, avg, min, max, cpu, median, overhead, first;
+            auto &info = infos.emplace_back();
+            fields >> info.count >> total >> avg >> min >> max >> cpu >> median
+                >> info.median_error >> overhead >> info.ghz >> info.ref_ghz >> info.cycles_per_ns
+                >> info.ref_cycles_per_ns >> first >> info.warmup;
+            info.total    = call_info::duration{total};
+            info.avg      = call_info::duration{avg};
+            info.min      = call_info::duration{min};
+            info.max      = call_info::duration{max};
+            info.cpu      = call_info::duration{cpu};
+            info.median   = call_info::duration{median};
+            info.overhead = call_info::duration{overhead};
+            info.first    = call_info::duration{first};
+        } else if(line.starts_with("c ") && !infos.empty()) {
+            double      value;
+            std::string name;
+            fields >> value;
+            std::getline(fields >> std::ws, name);
+            infos.back().counters[name] = value;
+        }
+    }
+    return infos;
+}
+
+
+#if TESUJI_HAS_FORK
+struct forked_result
+{
+    std::string data;   // everything the child sent
+    int         status; // as returned by waitpid
+
+    bool failed() const {
+        return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    std::string describe() const {
+        return WIFSIGNALED(status) ? std::format("signal {}", WTERMSIG(status))
+                                   : std::format("exit code {}", WEXITSTATUS(status));
+    }
+};
+
+
+// Runs `child(send)` in a forked process, where `send(std::string_view)` writes to a pipe to this
+// process. Returns once the child has exited. An exception escaping `child` ends the child with exit
+// code 1, it must not unwind into the caller's code in the copy of the program.
+inline forked_result run_forked(auto &&child) {
+    int fds[2];
+    if(pipe(fds) != 0) {
+        throw std::runtime_error("tesuji::timed: pipe() failed");
+    }
+
+    // anything still buffered would be written by both processes
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+
+    const pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw std::runtime_error("tesuji::timed: fork() failed");
+    }
+
+    if(pid == 0) {
+        close(fds[0]);
+        try {
+            child([fd = fds[1]](std::string_view data) {
+                for(size_t written = 0; written < data.size();) {
+                    auto n = write(fd, data.data() + written, data.size() - written);
+                    if(n <= 0) {
+                        _exit(1);
+                    }
+                    written += size_t(n);
+                }
+            });
+        } catch(const std::exception &e) {
+            std::cerr << std::format("tesuji::timed: child process threw: {}\n", e.what());
+            std::cerr.flush();
+            _exit(1);
+        } catch(...) {
+            _exit(1);
+        }
+        close(fds[1]);
+        // skip atexit handlers and static destructors, they belong to the parent
+        _exit(0);
+    }
+
+    close(fds[1]);
+    forked_result result{};
+    char          buffer[4096];
+    for(ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) != 0;) {
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        result.data.append(buffer, size_t(n));
+    }
+    close(fds[0]);
+
+    while(waitpid(pid, &result.status, 0) < 0 && errno == EINTR) {}
+    return result;
+}
+#endif
+
+
+// Writes a buffer twice the size of the largest cache, so that none of the caller's data is cached.
+inline void evict_caches() {
+    static const size_t size = []() {
+        uint64_t largest = 32 << 20;
+        for(const auto &c: current_context().caches) {
+            largest = std::max(largest, c.size);
+        }
+        return size_t(std::min<uint64_t>(2 * largest, uint64_t(256) << 20));
+    }();
+
+    std::vector<char> buffer(size);
+    for(size_t i = 0; i < size; i += 64) {
+        buffer[i] = char(i);
+    }
+    do_not_optimize(buffer.data());
+}
+} // namespace detail
+
+
+// Measures `func` as the first call in a fresh child process, `runs` times. The CPU caches are
+// evicted right before the call. Lazy binding and page faults of code the parent hasn't run yet
+// are part of the time, so call it before warming up `func` in this process. Without fork the
+// calls are made in this process after evicting the caches.
+call_info cold_calls(std::string_view name, size_t runs, auto &&func) {
+    using duration = call_info::duration;
+
+    auto coldCall = [&func]() {
+        detail::evict_caches();
+        auto start = high_resolution_clock::now();
+        detail::invoke_kept(func);
+        return duration_cast<duration>(high_resolution_clock::now() - start);
+    };
+
+    std::vector<duration> samples;
+    for(size_t run = 0; run < runs; ++run) {
+#if TESUJI_HAS_FORK
+        auto result = detail::run_forked([&](auto &&send) {
+            send(std::format("{}\n", coldCall().count()));
+        });
+        if(result.failed()) {
+            throw std::runtime_error(std::format("tesuji::timed: cold call of {} failed ({})",
+                                                 name, result.describe()));
+        }
+        if(!result.data.empty()) {
+            samples.emplace_back(std::stoll(result.data));
+        }
+#else
+        samples.push_back(coldCall());
+#endif
+    }
+
+    call_info info{std::string(name)};
+    info.count = samples.size();
+    if(samples.empty()) {
+        return info;
+    }
+    info.min = *std::min_element(samples.begin(), samples.end());
+    info.max = *std::max_element(samples.begin(), samples.end());
+    for(auto sample: samples) {
+        info.total += sample;
+    }
+    info.avg          = info.total / info.count;
+    info.median_error = detail::median_error(samples, info.median);
+    return info;
+}
+
+
+struct benchmark_runner
+{
+    enum class isolate
+    {
+        none,
+        per_benchmark,  // one child runs all repetitions of a benchmark
+        per_repetition, // one child per single run
+    };
+
+    struct benchmark
+    {
+        std::string                 name;
+        std::function<call_info()> run;
+    };
+
+    size_t                        repetitions = 1;
+    isolate                       isolation   = isolate::none;
+    bool                          shuffle     = false;
+    uint64_t                      seed        = std::random_device{}();
+    std::ostream                 *console     = &std::cout; // nullptr for silence
+    std::vector<benchmark>        benchmarks;
+    std::vector<benchmark_record> records;
+
+    benchmark_runner &add(std::string_view name, std::function<call_info()> run) {
+        benchmarks.push_back({std::string(name), std::move(run)});
+        return *this;
+    }
+
+    // Lvalue functions are referenced and must outlive `run()`, rvalues are moved in.
+    benchmark_runner &add(std::string_view name, const stop_rule &rule, auto &&func) {
+        if constexpr(std::is_lvalue_reference_v<decltype(func)>) {
+            return add(name, [name = std::string(name), rule, &func]() {
+                return calls(name, rule, func);
+            });
+        } else {
+            return add(name, [name = std::string(name), rule, func = std::move(func)]() mutable {
+                return calls(name, rule, func);
+            });
+        }
+    }
+
+    benchmark_runner &add(std::string_view name, size_t count, auto &&func) {
+        return add(name, stop_rule{.min_count = count, .max_count = count},
+                   std::forward<decltype(func)>(func));
+    }
+
+    const std::vector<benchmark_record> &run() {
+        std::vector<benchmark_record> runs;
+        auto                          append = [&runs](std::vector<benchmark_record> more) {
+            runs.insert(runs.end(), more.begin(), more.end());
+        };
+
+        if(shuffle) {
+            std::mt19937_64     rng{seed};
+            std::vector<size_t> order(benchmarks.size());
+            for(size_t rep = 0; rep < repetitions; ++rep) {
+                std::iota(order.begin(), order.end(), 0);
+                std::shuffle(order.begin(), order.end(), rng);
+                for(size_t family: order) {
+                    append(run_in_process(family, {rep}));
+                }
+            }
+        } else {
+            for(size_t family = 0; family < benchmarks.size(); ++family) {
+                std::vector<size_t> reps(repetitions);
+                std::iota(reps.begin(), reps.end(), 0);
+                if(isolation == isolate::per_benchmark) {
+                    append(run_in_process(family, reps));
+                } else {
+                    for(size_t rep: reps) {
+                        append(run_in_process(family, {rep}));
+                    }
+                }
+            }
+        }
+
+        // group by benchmark for the aggregates and the JSON output
+        std::stable_sort(runs.begin(), runs.end(), [](const auto &lhs, const auto &rhs) {
+            return std::tie(lhs.family_index, lhs.repetition_index)
+                 < std::tie(rhs.family_index, rhs.repetition_index);
+        });
+
+        records.clear();
+        for(auto first = runs.begin(); first != runs.end();) {
+            auto last = std::find_if(first, runs.end(), [&](const benchmark_record &r) {
+                return r.family_index != first->family_index;
+            });
+            std::vector<benchmark_record> family_records(first, last);
+            records.insert(records.end(), family_records.begin(), family_records.end());
+            if(family_records.size() > 1) {
+                add_aggregates(family_records);
+            }
+            first = last;
+        }
+        return records;
+    }
+
+    void write_json(std::ostream &os, std::string_view executable = "") const {
+        timed::write_json(os, current_context(executable), records);
+    }
+
+protected:
+    // Pads names to the longest benchmark name (plus aggregate suffix) so the columns line up.
+    void print(call_info info) const {
+        if(!console) {
+            return;
+        }
+        size_t width = 0;
+        for(const auto &bm: benchmarks) {
+            width = std::max(width, bm.name.size() + (repetitions > 1 ? 7 : 0));
+        }
+        info.name.resize(std::max(width, info.name.size()), ' ');
+        *console << info << std::endl;
+    }
+
+    benchmark_record make_record(size_t family, size_t rep, call_info info) const {
+        benchmark_record record{std::move(info), benchmarks[family].name};
+        record.info.name        = record.run_name;
+        record.family_index     = family;
+        record.repetitions      = repetitions;
+        record.repetition_index = rep;
+
+        print(record.info);
+        return record;
+    }
+
+    // Runs the given repetitions of a benchmark, in a child process if isolation is enabled.
+    std::vector<benchmark_record> run_in_process(size_t family, const std::vector<size_t> &reps) {
+        std::vector<benchmark_record> result;
+
+#if TESUJI_HAS_FORK
+        if(isolation != isolate::none) {
+            auto forked = detail::run_forked([&](auto &&send) {
+                for(size_t i = 0; i < reps.size(); ++i) {
+                    send(detail::serialize(benchmarks[family].run()));
+                }
+            });
+
+            auto infos = detail::deserialize(forked.data);
+            for(size_t i = 0; i < std::min(infos.size(), reps.size()); ++i) {
+                result.push_back(make_record(family, reps[i], std::move(infos[i])));
+            }
+            if(console && (forked.failed() || infos.size() < reps.size())) {
+                *console << std::format("{}: child process failed ({})\n",
+                                        benchmarks[family].name, forked.describe());
+            }
+            return result;
+        }
+#endif
+
+        for(size_t rep: reps) {
+            result.push_back(make_record(family, rep, benchmarks[family].run()));
+        }
+        return result;
+    }
+
+    // Aggregates are computed over per-iteration times and scaled back by the mean iteration
+    // count, so that `write_json` can treat them like any other record.
+    void add_aggregates(const std::vector<benchmark_record> &family_records) {
+        using nanoseconds_d = std::chrono::duration<double, std::nano>;
+
+        const double n     = double(family_records.size());
+        auto         perIt = [](const call_info &info, auto member) {
+            return nanoseconds_d(info.*member).count() / double(std::max<size_t>(info.count, 1));
+        };
+
+        auto aggregate_of = [&](std::string_view aggregate_name, auto reduce) {
+            benchmark_record record = family_records.front();
+            record.run_type         = "aggregate";
+            record.aggregate_name   = aggregate_name;
+            record.info.name        = std::format("{}_{}", record.run_name, aggregate_name);
+            record.info.counters.clear();
+            record.info.median            = call_info::duration::zero();
+            record.info.median_error      = 0;
+            record.info.ghz               = 0;
+            record.info.ref_ghz           = 0;
+            record.info.cycles_per_ns     = 0;
+            record.info.ref_cycles_per_ns = 0;
+            record.info.first             = call_info::duration::zero();
+            record.info.warmup            = 0;
+
+            size_t count = 0;
+            for(const auto &r: family_records) {
+                count += r.info.count;
+            }
+            record.info.count = std::max<size_t>(count / family_records.size(), 1);
+
+            for(auto member: {&call_info::total, &call_info::cpu}) {
+                std::vector<double> values;
+                for(const auto &r: family_records) {
+                    values.push_back(perIt(r.info, member));
+                }
+                record.info.*member = duration_cast<call_info::duration>(
+                    nanoseconds_d(reduce(values) * double(record.info.count)));
+            }
+            record.info.avg = record.info.total / record.info.count;
+            record.info.min = call_info::duration::zero();
+            record.info.max = call_info::duration::zero();
+
+            print(record.info);
+            records.push_back(record);
+        };
+
+        auto mean = [n](std::vector<double> &values) {
+            return std::accumulate(values.begin(), values.end(), 0.0) / n;
+        };
+        auto median = [](std::vector<double> &values) {
+            std::sort(values.begin(), values.end());
+            const size_t mid = values.size() / 2;
+            return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+        };
+        auto stddev = [n, &mean](std::vector<double> &values) {
+            const double m   = mean(values);
+            double       acc = 0;
+            for(double v: values) {
+                acc += (v - m) * (v - m);
+            }
+            return std::sqrt(acc / (n - 1));
+        };
+
+        aggregate_of("mean", mean);
+        aggregate_of("median", median);
+        aggregate_of("stddev", stddev);
+    }
+};
+
+
+}} // namespace tesuji::timed
+
+#undef TESUJI_HAS_FORK
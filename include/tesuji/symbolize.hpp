@@ -0,0 +1,208 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GNUG__)
+#    include <cxxabi.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <dlfcn.h>
+#endif
+
+#if defined(__linux__) && defined(__ELF__)
+#    include <elf.h>
+#    include <link.h>
+#    define TESUJI_HAS_ELF_SYMBOLS 1
+#else
+#    define TESUJI_HAS_ELF_SYMBOLS 0
+#endif
+
+
+namespace tesuji {
+
+// Provides names for code addresses, e.g. return addresses of allocation sites and stack frames.
+//      std::string symbolize(const void *address, bool returnAddress = true);
+//
+// Names come from the static symbol table of the module file if it has one, so functions that
+// aren't exported are found without -rdynamic, else from dladdr(). Without either, the result is
+// the module and the offset into it, which addr2line takes. Module symbol tables and names are
+// cached, so symbolizing the same addresses again is a map lookup. A return address points behind
+// the call, so it is looked up one byte earlier to stay in the calling function.
+//
+// Example:
+//      std::cout << tesuji::symbolize(__builtin_return_address(0)) << "\n";
+// Possible output:
+//      run_batch(config const&)+0x4f (app)
+//
+
+
+namespace detail {
+inline std::string demangle(const char *name) {
+#if defined(__GNUG__)
+    int   status    = 0;
+    char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if(status == 0) {
+        std::string result = demangled;
+        std::free(demangled);
+        return result;
+    }
+#endif
+    return name;
+}
+
+
+#if TESUJI_HAS_ELF_SYMBOLS
+struct elf_symbols
+{
+    bool                   absolute = false; // addresses of ET_EXEC files aren't relative
+    std::vector<ElfW(Sym)> symbols;
+    std::string            names;
+
+    // The function containing `address`, its mangled name and its start.
+    std::pair<const char *, uintptr_t> find(uintptr_t address) const {
+        for(const auto &sym: symbols) {
+            if(ELF64_ST_TYPE(sym.st_info) == STT_FUNC && sym.st_value <= address
+               && address < sym.st_value + std::max<uint64_t>(sym.st_size, 1)
+               && sym.st_name < names.size()) {
+                return {names.c_str() + sym.st_name, uintptr_t(sym.st_value)};
+            }
+        }
+        return {nullptr, 0};
+    }
+};
+
+
+// Reads the static symbol table of an ELF file of the native class. Stripped files have none.
+inline elf_symbols read_symbols(const std::string &path) {
+    elf_symbols   result;
+    std::ifstream in(path, std::ios::binary);
+
+    ElfW(Ehdr) ehdr;
+    if(!in.read((char *)&ehdr, sizeof(ehdr)) || std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+       || ehdr.e_shentsize != sizeof(ElfW(Shdr))) {
+        return result;
+    }
+    result.absolute = ehdr.e_type == ET_EXEC;
+
+    std::vector<ElfW(Shdr)> sections(ehdr.e_shnum);
+    in.seekg(std::streamoff(ehdr.e_shoff));
+    if(!in.read((char *)sections.data(), std::streamsize(sections.size() * sizeof(ElfW(Shdr))))) {
+        return result;
+    }
+
+    for(const auto &section: sections) {
+        if(section.sh_type != SHT_SYMTAB || section.sh_link >= sections.size()) {
+            continue;
+        }
+        const auto &strings = sections[section.sh_link];
+        result.symbols.resize(section.sh_size / sizeof(ElfW(Sym)));
+        result.names.resize(strings.sh_size);
+        in.seekg(std::streamoff(section.sh_offset));
+        in.read((char *)result.symbols.data(),
+                std::streamsize(result.symbols.size() * sizeof(ElfW(Sym))));
+        in.seekg(std::streamoff(strings.sh_offset));
+        in.read(result.names.data(), std::streamsize(result.names.size()));
+        if(!in) {
+            return {};
+        }
+        break;
+    }
+    return result;
+}
+
+
+// Symbol tables are read once per module and kept. Never destroyed, leak reports at exit use them.
+inline const elf_symbols &symbols_of(const std::string &path) {
+    static std::mutex                                      &mutex = *new std::mutex;
+    static std::map<std::string, elf_symbols, std::less<>> &cache =
+        *new std::map<std::string, elf_symbols, std::less<>>;
+
+    std::lock_guard lock(mutex);
+    auto            it = cache.find(path);
+    if(it == cache.end()) {
+        it = cache.emplace(path, read_symbols(path)).first;
+    }
+    return it->second;
+}
+#endif
+
+
+inline std::string module_name(std::string_view path) {
+    if(auto pos = path.find_last_of("/\\"); pos != std::string_view::npos) {
+        path.remove_prefix(pos + 1);
+    }
+    return std::string(path);
+}
+
+
+inline std::string resolve(const void *address, bool returnAddress) {
+    const auto lookup = uintptr_t(address) - (returnAddress ? 1 : 0);
+#if defined(__unix__) || defined(__APPLE__)
+    Dl_info info;
+    if(!dladdr((const void *)lookup, &info) || !info.dli_fname) {
+        return std::format("{}", address);
+    }
+    const std::string module = module_name(info.dli_fname);
+    const auto        base   = uintptr_t(info.dli_fbase);
+
+#    if TESUJI_HAS_ELF_SYMBOLS
+    // the executable is "" for dladdr on some systems
+    const std::string path    = *info.dli_fname ? info.dli_fname : "/proc/self/exe";
+    const auto       &symbols = symbols_of(path);
+    const uintptr_t   offset  = symbols.absolute ? lookup : lookup - base;
+    if(auto [name, start] = symbols.find(offset); name) {
+        const uintptr_t into = offset - start + (lookup != uintptr_t(address));
+        return std::format("{}+{:#x} ({})", demangle(name), into, module);
+    }
+#    endif
+    if(info.dli_sname) {
+        return std::format("{}+{:#x} ({})", demangle(info.dli_sname),
+                           uintptr_t(address) - uintptr_t(info.dli_saddr), module);
+    }
+    return std::format("{}+{:#x}", module, uintptr_t(address) - base);
+#else
+    (void)lookup;
+    return std::format("{}", address);
+#endif
+}
+} // namespace detail
+
+
+inline std::string symbolize(const void *address, bool returnAddress = true) {
+    // never destroyed, like the symbol tables
+    static std::mutex                                    &mutex = *new std::mutex;
+    static std::unordered_map<const void *, std::string> &cache =
+        *new std::unordered_map<const void *, std::string>;
+
+    {
+        std::lock_guard lock(mutex);
+        if(auto it = cache.find(address); it != cache.end()) {
+            return it->second;
+        }
+    }
+    std::string name = detail::resolve(address, returnAddress);
+
+    std::lock_guard lock(mutex);
+    return cache.emplace(address, std::move(name)).first->second;
+}
+
+
+} // namespace tesuji
+
+#undef TESUJI_HAS_ELF_SYMBOLS
@@ -9,10 +9,47 @@
 #    include "version.hpp"
 #endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
 #include <format>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <time.h>
+#endif
+
+#if defined(__linux__)
+#    include <fcntl.h>
+#    include <linux/perf_event.h>
+#    include <sched.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#    define TESUJI_HAS_RDTSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#    include <intrin.h>
+#    define TESUJI_HAS_RDTSC 1
+#else
+#    define TESUJI_HAS_RDTSC 0
+#endif
 
 
 namespace tesuji { namespace timed {
@@ -28,7 +65,10 @@ namespace tesuji { namespace timed {
 //
 //
 // Provides a class to measure the time between construction and destruction of that object. Blocks
-// can be nested and will be indented accordingly.
+// can be nested and will be indented accordingly, per thread. The measured overhead of the nested
+// blocks is subtracted from their parents, and an outermost block reports how much that was. That
+// is a fixed cost measured once per `block<IndentFactor>` type, plus the time the nested blocks
+// took to write their output, measured on every write to whatever stream they write to.
 //      struct block;
 // Example:
 //      {
@@ -42,6 +82,7 @@ namespace tesuji { namespace timed {
 // Possible output:
 //          do_more_stuff_block: 13ms
 //      do_stuff_block: 42ms
+//      instrumentation cost: 1 nested blocks, 310ns subtracted
 //
 //
 // Provides a function to measure the time of a single function call, returning the result of the
@@ -57,7 +98,14 @@ namespace tesuji { namespace timed {
 //
 //
 // Provides a function to measure the time of multiple function calls, returning a struct with
-// information about the calls. This struct can be printed to cout.
+// information about the calls. This struct can be printed to cout. Besides wall time it records
+// the CPU time the calling thread spent in all calls, and it carries user `counters` that are
+// passed through to the benchmark JSON output (see benchmark.hpp).
+// Turbo and frequency scaling make ns per call unstable, so `calls` also measures the effective
+// CPU frequency while the calls ran, over the thread's CPU time, so that calls that block or sleep
+// don't lower it, and reports cycles and reference cycles per call. It uses the perf
+// `cycles` and `ref-cycles` events on Linux, or else the TSC with the APERF/MPERF ratio if
+// /dev/cpu/*/msr is readable, or else the TSC only (reference cycles, no effective frequency).
 //      struct call_info;
 //      call_info calls(std::string_view name, size_t count, auto &&func);
 // Example:
@@ -68,7 +116,73 @@ namespace tesuji { namespace timed {
 //      };
 //      cout << timed::calls("random_sleeper", 100, f) << endl;
 // Possible output:
-//      random_sleeper: total: 5.0575s avg: 55ms, min: 3700ns, max: 110ms
+//      random_sleeper: total: 5.0575s avg: 55ms, min: 3700ns, max: 110ms, calls: 100, first: 21ms,
+//      ref cycles: 115500000.0
+//
+// The first call pays for page faults, lazy binding and cold caches, so it is timed on its own as
+// `call_info::first` and not part of the other values. A stop_rule can discard a number of further
+// warm-up calls, or discard batches of calls until their median settles. For the first call in a
+// fresh process see `cold_calls` in benchmark.hpp.
+//
+// Instead of a fixed count, `calls` takes a stopping rule: run for at least a minimum time and/or
+// until the 95% confidence interval of the median is within ±precision of the median, capped by a
+// maximum count and time. `call_info::count` is the number of calls actually measured.
+//      struct stop_rule;
+//      call_info calls(std::string_view name, const stop_rule &rule, auto &&func);
+// Example:
+//      cout << timed::calls("parse", {.min_count = 1000, .detect_warmup = true}, parse) << endl;
+//      cout << timed::calls("mt19937_64", {.max_count = 10'000'000, .precision = 0.01}, rng)
+//           << endl;
+// Possible output:
+//      mt19937_64: total: 2ms, avg: 58ns, min: 31ns, max: 12µs, calls: 40960, median: 56ns ±0.9%
+//
+// Calling a function on the same input over and over lets the branch predictor and the caches
+// learn it. A `dataset` holds inputs that are materialized and shuffled up front; `calls` cycles
+// through them, passing one per call. Its size controls the cache residency of the inputs. The
+// cost of loading an input is subtracted from the results and reported as `call_info::overhead`:
+// timed calls that only read their input, on the same dataset, less timed calls that do nothing.
+// The two clock reads around each call are not subtracted, as in the overload without inputs, so
+// the results of both are comparable.
+//      template<typename T> struct dataset;
+//      call_info calls(std::string_view name, const stop_rule &rule, auto &&func,
+//                      const dataset<T> &inputs);
+//      void do_not_optimize(const auto &value);
+// Example:
+//      std::mt19937_64 rng{42};
+//      timed::dataset keys(1 << 20, [&]() { return rng() % table.size(); });
+//      cout << timed::calls("lookup", 1'000'000, [&](size_t key) { return table.find(key); }, keys)
+//           << endl;
+// Possible output:
+//      lookup: total: 62ms, avg: 62ns, min: 20ns, max: 20µs, calls: 1000000, overhead: 3ns
+//
+//
+// Provides thread-safe aggregating statistics (count, total, min, max and a log2 histogram of
+// durations) and a scope that adds its lifetime to them. Entries are looked up by name; cache the
+// reference in hot code, the lookup takes a lock.
+//      struct stats;
+//      stats &stats_for(std::string_view name);
+//      struct aggregate;
+//      void report(std::ostream &os = std::cout);
+// Example:
+//      static auto &parseStats = timed::stats_for("parse");
+//      for(auto &line: lines) {
+//          timed::aggregate a(parseStats);
+//          parse(line);
+//      }
+//      timed::report();
+// Possible output:
+//      parse: count: 1000, total: 42ms, avg: 42µs, min: 30µs, max: 2ms
+//      instrumentation cost: block: 290ns, nested block: 310ns, sampled out: 3ns, aggregate: 45ns
+//
+// A `sampled` scope only times a random 1 in `Every` of its entries, the others cost a few
+// instructions. Its stats count the sampled entries only.
+//      template<uint32_t Every> struct sampled;
+//
+// Provides the instrumentation's own costs, measured once per process on first use: an empty
+// block, a block nested in another one, a sampled out scope and an aggregate scope. Blocks are
+// measured with their output formatted but not written.
+//      struct instrumentation_cost;
+//      const instrumentation_cost &instrumentation_overhead();
 //
 
 
@@ -104,25 +218,92 @@ std::string durationToHumanString(auto duration) {
 };
 
 
+struct instrumentation_cost
+{
+    nanoseconds block{0};
+    nanoseconds nested_block{0};
+    nanoseconds sampled_out{0};
+    nanoseconds aggregate{0};
+};
+
+const instrumentation_cost &instrumentation_overhead();
+
+
+inline std::ostream &operator<<(std::ostream &os, const instrumentation_cost &cost) {
+    return os << std::format(
+               "instrumentation cost: block: {}, nested block: {}, sampled out: {}, aggregate: {}",
+               durationToHumanString(cost.block), durationToHumanString(cost.nested_block),
+               durationToHumanString(cost.sampled_out), durationToHumanString(cost.aggregate));
+}
+
+
+namespace detail {
+// Set while the overhead is measured, so the measuring blocks don't ask for it.
+inline thread_local bool measuringOverhead = false;
+
+// The cost of a `Block` nested in another one, without writing its output.
+template<typename Block> nanoseconds nested_block_overhead();
+} // namespace detail
+
+
 template<size_t IndentFactor = 4> struct block
 {
-    static inline size_t          indent        = 0;
-    static constexpr const size_t indent_factor = IndentFactor;
+    static inline thread_local size_t indent        = 0;
+    static inline thread_local block *current       = nullptr;
+    static constexpr const size_t     indent_factor = IndentFactor;
 
     std::string                       name;
+    std::ostream                     *os;
+    block                            *parent;
+    size_t                            descendants{0};
+    nanoseconds                       written{0}; // the time the descendants took to write output
     high_resolution_clock::time_point start;
+    std::string                       note; // appended to the output, e.g. by tracked::memory_scope
 
-    block(std::string_view name = "local_block")
+    block(std::string_view name = "local_block", std::ostream &os = std::cout)
         : name(name)
+        , os(&os)
+        , parent(current)
         , start(high_resolution_clock::now()) {
         ++indent;
+        current = this;
     }
 
     ~block() {
         auto end      = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(end - start);
-        std::cout << std::format("{}{}: {}\n", std::string(--indent * indent_factor, ' '), name,
-                                 durationToHumanString(duration));
+        auto duration = duration_cast<nanoseconds>(end - start);
+
+        current = parent;
+
+        // The fixed cost of a nested block is measured once for this type, the time its output took
+        // is measured on every write, as it depends on the stream.
+        nanoseconds compensation{0};
+        if(descendants > 0 && !detail::measuringOverhead) {
+            compensation = nested_overhead() * descendants + written;
+            duration     = std::max(duration - compensation, 0ns);
+        }
+
+        const std::string line =
+            std::format("{}{}: {}{}{}\n", std::string(--indent * indent_factor, ' '), name,
+                        durationToHumanString(duration), note.empty() ? "" : ", ", note);
+        const auto writeStart = high_resolution_clock::now();
+        *os << line;
+        if(parent) {
+            parent->descendants += descendants + 1;
+            parent->written += written + (high_resolution_clock::now() - writeStart);
+        } else if(compensation > 0ns) {
+            *os << std::format("instrumentation cost: {} nested blocks, {} subtracted\n",
+                               descendants, durationToHumanString(compensation));
+        }
+    }
+
+    static nanoseconds nested_overhead() {
+        if constexpr(std::is_same_v<block, block<>>) {
+            return instrumentation_overhead().nested_block;
+        } else {
+            static const nanoseconds cost = detail::nested_block_overhead<block>();
+            return cost;
+        }
     }
 };
 
@@ -133,6 +314,189 @@ auto call(std::string_view name, auto &&func, auto&&... args) {
 }
 
 
+namespace detail {
+// CPU time consumed by the calling thread, or by the process where that is not available.
+inline nanoseconds thread_cpu_time() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return seconds{ts.tv_sec} + nanoseconds{ts.tv_nsec};
+#else
+    return duration_cast<nanoseconds>(
+        std::chrono::duration<double>(double(std::clock()) / CLOCKS_PER_SEC));
+#endif
+}
+
+
+// Reads core cycles and reference cycles of the calling thread, from the best available source.
+// A reading is only comparable to another one of the same thread and process.
+struct cycle_counter
+{
+    struct reading
+    {
+        uint64_t cycles{0};     // 0 if unknown
+        uint64_t ref_cycles{0}; // 0 if unknown
+        uint64_t aperf{0};      // the MSR source is per CPU,
+        uint64_t mperf{0};      // only readings from the same `cpu` can be compared
+        int      cpu{-1};
+    };
+
+    static cycle_counter &instance() {
+        static thread_local cycle_counter counter;
+#if defined(__linux__)
+        // perf events count the thread that opened them, a forked child must open its own
+        if(counter.m_pid != getpid()) {
+            counter = cycle_counter{};
+        }
+#endif
+        return counter;
+    }
+
+    reading read() const {
+        reading r;
+#if defined(__linux__)
+        if(m_cyclesFd >= 0 && m_refFd >= 0) {
+            (void)!::read(m_cyclesFd, &r.cycles, sizeof(r.cycles));
+            (void)!::read(m_refFd, &r.ref_cycles, sizeof(r.ref_cycles));
+            return r;
+        }
+#endif
+#if TESUJI_HAS_RDTSC
+        r.ref_cycles = __rdtsc();
+#endif
+#if defined(__linux__)
+        if(m_msr) {
+            r.cpu = sched_getcpu();
+            if(!read_msr(r.cpu, 0xE8, r.aperf) || !read_msr(r.cpu, 0xE7, r.mperf)) {
+                r.cpu = -1;
+            }
+        }
+#endif
+        return r;
+    }
+
+    // The frequencies while the thread ran, and the cycles per ns of wall-clock time. These differ
+    // by the share of the time the thread spent blocked or sleeping.
+    struct rates
+    {
+        double ghz{0};               // effective CPU frequency, 0 if unknown
+        double ref_ghz{0};           // reference frequency, 0 if unknown
+        double cycles_per_ns{0};     // of wall-clock time
+        double ref_cycles_per_ns{0}; // of wall-clock time
+    };
+
+    // Between two readings `wall` apart, during which the thread used `cpu` of CPU time.
+    rates
+    frequencies(const reading &begin, const reading &end, nanoseconds wall, nanoseconds cpu) const {
+        const double wallNs = double(wall.count());
+        // a coarse CPU clock may not have advanced at all
+        const double cpuNs = cpu > 0ns ? std::min(double(cpu.count()), wallNs) : wallNs;
+        if(wallNs <= 0 || end.ref_cycles <= begin.ref_cycles) {
+            return {};
+        }
+        const double refCycles = double(end.ref_cycles - begin.ref_cycles);
+
+        // perf events only count while the thread runs
+        if(end.cycles > begin.cycles) {
+            const double cycles = double(end.cycles - begin.cycles);
+            return {cycles / cpuNs, refCycles / cpuNs, cycles / wallNs, refCycles / wallNs};
+        }
+
+        // The TSC ticks at the reference frequency all the time. APERF/MPERF scales it to the
+        // actual one, both only count while the CPU runs.
+        rates r;
+        r.ref_ghz           = refCycles / wallNs;
+        r.ref_cycles_per_ns = r.ref_ghz;
+        if(begin.cpu >= 0 && begin.cpu == end.cpu && end.mperf > begin.mperf) {
+            r.ghz = r.ref_ghz * double(end.aperf - begin.aperf) / double(end.mperf - begin.mperf);
+            r.cycles_per_ns = r.ghz * cpuNs / wallNs;
+        }
+        return r;
+    }
+
+    cycle_counter() {
+#if defined(__linux__)
+        m_pid      = getpid();
+        m_cyclesFd = open_event(PERF_COUNT_HW_CPU_CYCLES);
+        m_refFd    = open_event(PERF_COUNT_HW_REF_CPU_CYCLES);
+        if(m_cyclesFd < 0 || m_refFd < 0) {
+            close_events();
+            uint64_t ignored;
+            m_msr = TESUJI_HAS_RDTSC && read_msr(sched_getcpu(), 0xE8, ignored);
+        }
+#endif
+    }
+
+    cycle_counter(const cycle_counter &) = delete;
+
+    cycle_counter &operator=(cycle_counter &&rhs) {
+#if defined(__linux__)
+        close_events();
+        m_pid      = rhs.m_pid;
+        m_cyclesFd = std::exchange(rhs.m_cyclesFd, -1);
+        m_refFd    = std::exchange(rhs.m_refFd, -1);
+#endif
+        m_msr = rhs.m_msr;
+        return *this;
+    }
+
+    ~cycle_counter() {
+#if defined(__linux__)
+        close_events();
+#endif
+    }
+
+private:
+    bool m_msr{false};
+
+#if defined(__linux__)
+    pid_t m_pid{-1};
+    int   m_cyclesFd{-1};
+    int   m_refFd{-1};
+
+    static int open_event(uint64_t config) {
+        perf_event_attr attr{};
+        attr.type       = PERF_TYPE_HARDWARE;
+        attr.size       = sizeof(attr);
+        attr.config     = config;
+        attr.exclude_hv = 1;
+
+        // kernel time is part of the wall time, but counting it may not be permitted
+        int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if(fd < 0) {
+            attr.exclude_kernel = 1;
+            fd                  = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+        return fd;
+    }
+
+    void close_events() {
+        if(m_cyclesFd >= 0) {
+            close(std::exchange(m_cyclesFd, -1));
+        }
+        if(m_refFd >= 0) {
+            close(std::exchange(m_refFd, -1));
+        }
+    }
+
+    static bool read_msr(int cpu, uint32_t msr, uint64_t &value) {
+        if(cpu < 0) {
+            return false;
+        }
+        const auto path = std::format("/dev/cpu/{}/msr", cpu);
+        const int  fd   = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        const bool ok = pread(fd, &value, sizeof(value), msr) == sizeof(value);
+        close(fd);
+        return ok;
+    }
+#endif
+};
+} // namespace detail
+
+
 struct call_info
 {
     using duration = high_resolution_clock::time_point::duration;
@@ -143,46 +507,627 @@ struct call_info
     duration    avg{0};
     duration    min{0};
     duration    max{0};
+    duration    cpu{0}; // CPU time of all calls, including the loop overhead
+    duration    median{0};
+    double      median_error{0}; // relative half-width of the median's 95% CI
+    // median and median_error are only computed if a stop_rule asks for a precision
+    duration    overhead{0}; // per call input load, already subtracted from the durations above
+    duration    first{0};    // the first call, not part of the values above
+    size_t      warmup{0};   // calls discarded after the first one
+    double      ghz{0};      // effective CPU frequency while the calls ran, 0 if unknown
+    double      ref_ghz{0};  // reference frequency, 0 if unknown
+    // Cycles per ns of wall-clock time. Below the frequencies if the calls blocked or slept.
+    double cycles_per_ns{0};
+    double ref_cycles_per_ns{0};
+
+    // per call, from `avg` and the measured cycles
+    double cycles() const {
+        return double(duration_cast<nanoseconds>(avg).count()) * cycles_per_ns;
+    }
+
+    double ref_cycles() const {
+        return double(duration_cast<nanoseconds>(avg).count()) * ref_cycles_per_ns;
+    }
+
+    std::map<std::string, double, std::less<>> counters{};
 };
 
 
 std::ostream &operator<<(std::ostream &os, const call_info &info) {
-    return os << std::format("{}: total: {: >5}, avg: {: >5}, min: {: >5}, max: {: >5}", info.name,
-                             durationToHumanString(info.total), durationToHumanString(info.avg),
-                             durationToHumanString(info.min), durationToHumanString(info.max));
+    os << std::format("{}: total: {: >5}, avg: {: >5}, min: {: >5}, max: {: >5}, calls: {}",
+                      info.name, durationToHumanString(info.total),
+                      durationToHumanString(info.avg), durationToHumanString(info.min),
+                      durationToHumanString(info.max), info.count);
+    if(info.first > call_info::duration::zero()) {
+        os << std::format(", first: {}", durationToHumanString(info.first));
+    }
+    if(info.warmup > 0) {
+        os << std::format(", warmup: {}", info.warmup);
+    }
+    if(info.median > call_info::duration::zero()) {
+        os << std::format(", median: {} ±{:.1f}%", durationToHumanString(info.median),
+                          100.0 * info.median_error);
+    }
+    if(info.overhead > call_info::duration::zero()) {
+        os << std::format(", overhead: {}", durationToHumanString(info.overhead));
+    }
+    if(info.ghz > 0) {
+        os << std::format(", cycles: {:.1f} @ {:.2f}GHz", info.cycles(), info.ghz);
+    }
+    if(info.ref_ghz > 0) {
+        os << std::format(", ref cycles: {:.1f}", info.ref_cycles());
+    }
+    return os;
 }
 
 
-call_info calls(std::string_view name, size_t count, auto &&func) {
-    call_info info{std::string(name), count};
+struct stop_rule
+{
+    size_t      min_count = 1;
+    size_t      max_count = std::numeric_limits<size_t>::max();
+    nanoseconds min_time  = 0ns;
+    nanoseconds max_time  = nanoseconds::max();
+    double      precision = 0; // e.g. 0.01 for ±1%, 0 to not check
+
+    // Calls discarded after the first one. With `detect_warmup` batches of 32 calls are discarded
+    // until the median of a batch is within 5% of the one before, `warmup` calls at most (10000
+    // if 0). A `warmup` below two batches discards exactly that many calls.
+    size_t warmup        = 0;
+    bool   detect_warmup = false;
+};
+
+
+namespace detail {
+// Distribution-free 95% confidence interval of the median from order statistics: with n samples
+// the bounds are the ranks n/2 ± 1.96*sqrt(n)/2. Reorders `samples`, which doesn't matter to the
+// caller as long as only their distribution is of interest.
+template<typename Duration>
+double median_error(std::vector<Duration> &samples, Duration &median) {
+    const size_t n    = samples.size();
+    const double half = 0.98 * std::sqrt(double(n));
+    const size_t lo   = size_t(std::max(0.0, std::floor(double(n) / 2 - half)));
+    const size_t hi   = std::min(n - 1, size_t(std::ceil(double(n) / 2 + half)));
+
+    auto mid = samples.begin() + n / 2;
+    std::nth_element(samples.begin(), mid, samples.end());
+    median = *mid;
+    std::nth_element(samples.begin(), samples.begin() + lo, mid);
+    std::nth_element(mid, samples.begin() + hi, samples.end());
+
+    if(median.count() <= 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    const auto width = std::max(median - samples[lo], samples[hi] - median);
+    return double(width.count()) / double(median.count());
+}
+} // namespace detail
+
+
+// Keeps the compiler from optimizing away the computation of `value`.
+template<typename T> inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const volatile void *sink;
+    sink = &value;
+#endif
+}
 
-    if(count == 0) {
+
+template<typename T> struct dataset
+{
+    std::vector<T> values;
+
+    // Calls `generator()` `size` times and shuffles the results.
+    dataset(size_t size, auto &&generator, uint64_t seed = 0) {
+        values.reserve(size);
+        for(size_t i = 0; i < size; ++i) {
+            values.push_back(generator());
+        }
+        shuffle(seed);
+    }
+
+    // Repeats `inputs` until `size` values are reached (all of them if `size` is 0), shuffled.
+    dataset(const std::vector<T> &inputs, size_t size = 0, uint64_t seed = 0) {
+        size = size == 0 ? inputs.size() : size;
+        values.reserve(size);
+        for(size_t i = 0; i < size && !inputs.empty(); ++i) {
+            values.push_back(inputs[i % inputs.size()]);
+        }
+        shuffle(seed);
+    }
+
+    // The number of values that occupy about `bytes`, e.g. to size a dataset to fit into L1.
+    static constexpr size_t size_for(size_t bytes) {
+        return std::max<size_t>(1, bytes / sizeof(T));
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    size_t bytes() const {
+        return values.size() * sizeof(T);
+    }
+
+protected:
+    void shuffle(uint64_t seed) {
+        std::mt19937_64 rng{seed};
+        std::shuffle(values.begin(), values.end(), rng);
+    }
+};
+
+template<typename Generator>
+dataset(size_t, Generator &&, uint64_t = 0)
+    -> dataset<std::decay_t<std::invoke_result_t<Generator &>>>;
+
+
+namespace detail {
+// Calls `func(args...)`, keeping its result alive.
+inline void invoke_kept(auto &&func, auto &&...args) {
+    if constexpr(std::is_void_v<decltype(func(std::forward<decltype(args)>(args)...))>) {
+        func(std::forward<decltype(args)>(args)...);
+    } else {
+        do_not_optimize(func(std::forward<decltype(args)>(args)...));
+    }
+}
+
+
+// The loop shared by all `calls` variants. `timedCall()` makes one call and returns its start and
+// end time points.
+call_info calls_loop(std::string_view name, const stop_rule &rule, auto &&timedCall) {
+    using duration = call_info::duration;
+
+    call_info info{std::string(name)};
+    info.min = duration::max();
+
+    if(rule.max_count == 0) {
+        info.min = duration::zero();
         return info;
     }
 
-    // "warmup" to get some initial values
+    // Samples are only kept to check the precision; the check runs whenever the count grew by a
+    // quarter, so it adds O(1) amortized work per call, outside of the timed region.
+    std::vector<duration> samples;
+    size_t                nextCheck = std::max<size_t>(rule.min_count, 32);
+    if(rule.precision > 0) {
+        samples.reserve(std::min<size_t>(rule.max_count, 1 << 16));
+    }
+
     {
-        auto start = high_resolution_clock::now();
-        (void)func();
-        info.total = high_resolution_clock::now() - start;
-        info.min   = info.total;
-        info.max   = info.total;
+        auto [start, end] = timedCall();
+        info.first        = end - start;
     }
 
-    // start at 1 because we already did one call
-    for(size_t i = 1; i < count; ++i) {
-        auto start = high_resolution_clock::now();
-        (void)func();
-        auto duration = high_resolution_clock::now() - start;
+    // Detection compares batches, a limit below two of them discards a fixed count instead.
+    static constexpr size_t batchSize = 32;
+    const size_t            limit     = rule.warmup == 0 ? 10000 : rule.warmup;
+    if(rule.detect_warmup && limit >= 2 * batchSize) {
+        std::vector<duration> batch(batchSize);
+        duration              previous = duration::max();
+        while(info.warmup + batchSize <= limit) {
+            for(auto &sample: batch) {
+                auto [start, end] = timedCall();
+                sample            = end - start;
+            }
+            info.warmup += batchSize;
+
+            auto mid = batch.begin() + batchSize / 2;
+            std::nth_element(batch.begin(), mid, batch.end());
+            const auto diff = *mid > previous ? *mid - previous : previous - *mid;
+            if(previous != duration::max() && diff * 20 <= previous) {
+                break;
+            }
+            previous = *mid;
+        }
+    } else {
+        for(; info.warmup < rule.warmup; ++info.warmup) {
+            (void)timedCall();
+        }
+    }
+
+    const auto &counter     = detail::cycle_counter::instance();
+    const auto  cpuStart    = detail::thread_cpu_time();
+    const auto  cyclesStart = counter.read();
+    const auto  begin       = high_resolution_clock::now();
+
+    while(info.count < rule.max_count) {
+        auto [start, end] = timedCall();
+        auto duration     = end - start;
         info.total += duration;
         info.min = std::min(info.min, duration);
         info.max = std::max(info.max, duration);
+        ++info.count;
+
+        if(rule.precision > 0) {
+            samples.push_back(duration);
+        }
+
+        const auto elapsed = end - begin;
+        if(elapsed >= rule.max_time) {
+            break;
+        }
+        if(info.count < rule.min_count || elapsed < rule.min_time) {
+            continue;
+        }
+        if(rule.precision <= 0) {
+            break;
+        }
+        if(info.count >= nextCheck) {
+            if(detail::median_error(samples, info.median) <= rule.precision) {
+                break;
+            }
+            nextCheck = info.count + info.count / 4;
+        }
     }
 
-    info.avg = info.total / info.count;
+    const auto loopEnd   = high_resolution_clock::now();
+    const auto cyclesEnd = counter.read();
+    info.cpu             = detail::thread_cpu_time() - cpuStart;
+    info.avg             = info.total / info.count;
+
+    const auto rates = counter.frequencies(cyclesStart, cyclesEnd,
+                                           duration_cast<nanoseconds>(loopEnd - begin),
+                                           duration_cast<nanoseconds>(info.cpu));
+    info.ghz               = rates.ghz;
+    info.ref_ghz           = rates.ref_ghz;
+    info.cycles_per_ns     = rates.cycles_per_ns;
+    info.ref_cycles_per_ns = rates.ref_cycles_per_ns;
+
+    if(rule.precision > 0) {
+        info.median_error = detail::median_error(samples, info.median);
+    }
 
     return info;
 }
 
 
+// Subtracts a per call overhead from all durations of `info`.
+inline void subtract_overhead(call_info &info, call_info::duration overhead) {
+    using duration = call_info::duration;
+
+    const auto count = static_cast<duration::rep>(info.count);
+    auto       minus = [overhead](duration d) {
+        return std::max(d - overhead, duration::zero());
+    };
+
+    info.overhead = overhead;
+    info.total    = std::max(info.total - overhead * count, duration::zero());
+    info.avg      = count == 0 ? duration::zero() : info.total / count;
+    info.min      = minus(info.min);
+    info.max      = minus(info.max);
+    info.first    = minus(info.first);
+    if(info.median > duration::zero()) {
+        info.median = minus(info.median);
+    }
+}
+} // namespace detail
+
+
+call_info calls(std::string_view name, const stop_rule &rule, auto &&func) {
+    return detail::calls_loop(name, rule, [&func]() {
+        auto start = high_resolution_clock::now();
+        detail::invoke_kept(func);
+        return std::pair{start, high_resolution_clock::now()};
+    });
+}
+
+
+template<typename T>
+call_info
+calls(std::string_view name, const stop_rule &rule, auto &&func, const dataset<T> &inputs) {
+    if(inputs.values.empty()) {
+        return call_info{std::string(name)};
+    }
+
+    // The input is picked before the clock starts, the load of its value happens inside `func`.
+    auto cycle = [&inputs](auto &&f) {
+        return [&inputs, &f, i = size_t{0}]() mutable {
+            const T &input = inputs.values[i];
+            i              = i + 1 == inputs.values.size() ? 0 : i + 1;
+
+            auto start = high_resolution_clock::now();
+            detail::invoke_kept(f, input);
+            return std::pair{start, high_resolution_clock::now()};
+        };
+    };
+
+    // Only the load of the input is subtracted: the median of calls that only read it, less the
+    // median of calls that do nothing. The clock reads stay in, like without a dataset.
+    auto nothing = []() {
+        auto start = high_resolution_clock::now();
+        return std::pair{start, high_resolution_clock::now()};
+    };
+    auto sink = [](const T &input) { do_not_optimize(input); };
+
+    const stop_rule baselineRule{.min_count = 1024, .max_count = 1 << 16, .precision = 0.01};
+    const auto      empty = detail::calls_loop("", baselineRule, nothing);
+    const auto      loads = detail::calls_loop("", baselineRule, cycle(sink));
+
+    auto info = detail::calls_loop(name, rule, cycle(func));
+    detail::subtract_overhead(info, std::max(loads.median - empty.median, call_info::duration{}));
+    return info;
+}
+
+
+call_info calls(std::string_view name, size_t count, auto &&func) {
+    return calls(name, stop_rule{.min_count = count, .max_count = count}, func);
+}
+
+
+template<typename T>
+call_info calls(std::string_view name, size_t count, auto &&func, const dataset<T> &inputs) {
+    return calls(name, stop_rule{.min_count = count, .max_count = count}, func, inputs);
+}
+
+
+struct stats
+{
+    // Bucket i counts durations d with std::bit_width(d in ns) == i, that is [2^(i-1), 2^i) ns.
+    // The last bucket takes everything above ~39h.
+    static constexpr size_t bucket_count = 48;
+
+    std::atomic<uint64_t>                           count{0};
+    std::atomic<uint64_t>                           total{0}; // ns
+    std::atomic<uint64_t>                           min{UINT64_MAX};
+    std::atomic<uint64_t>                           max{0};
+    std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+
+    void add(nanoseconds duration) {
+        const uint64_t ns = duration.count() < 0 ? 0 : static_cast<uint64_t>(duration.count());
+
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t prev = min.load(std::memory_order_relaxed);
+        while(ns < prev && !min.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+        prev = max.load(std::memory_order_relaxed);
+        while(ns > prev && !max.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+
+        const size_t bucket = std::min<size_t>(std::bit_width(ns), bucket_count - 1);
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Adds everything `other` recorded to this.
+    void merge(const stats &other) {
+        count.fetch_add(other.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.fetch_add(other.total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        const uint64_t otherMin = other.min.load(std::memory_order_relaxed);
+        uint64_t       prev     = min.load(std::memory_order_relaxed);
+        while(otherMin < prev
+              && !min.compare_exchange_weak(prev, otherMin, std::memory_order_relaxed)) {}
+        const uint64_t otherMax = other.max.load(std::memory_order_relaxed);
+        prev                    = max.load(std::memory_order_relaxed);
+        while(otherMax > prev
+              && !max.compare_exchange_weak(prev, otherMax, std::memory_order_relaxed)) {}
+
+        for(size_t i = 0; i < bucket_count; ++i) {
+            buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+        }
+    }
+
+    nanoseconds total_duration() const {
+        return nanoseconds{total.load(std::memory_order_relaxed)};
+    }
+
+    nanoseconds avg() const {
+        const auto n = count.load(std::memory_order_relaxed);
+        return n == 0 ? 0ns : nanoseconds{total.load(std::memory_order_relaxed) / n};
+    }
+
+    nanoseconds min_duration() const {
+        return count.load(std::memory_order_relaxed) == 0
+                 ? 0ns
+                 : nanoseconds{min.load(std::memory_order_relaxed)};
+    }
+
+    nanoseconds max_duration() const {
+        return nanoseconds{max.load(std::memory_order_relaxed)};
+    }
+};
+
+
+inline std::ostream &operator<<(std::ostream &os, const stats &s) {
+    return os << std::format("count: {}, total: {: >5}, avg: {: >5}, min: {: >5}, max: {: >5}",
+                             s.count.load(std::memory_order_relaxed),
+                             durationToHumanString(s.total_duration()),
+                             durationToHumanString(s.avg()),
+                             durationToHumanString(s.min_duration()),
+                             durationToHumanString(s.max_duration()));
+}
+
+
+// Prints one line per non-empty histogram bucket with its lower bound, count and a bar.
+inline void print_histogram(std::ostream &os, const stats &s, size_t indent = 4) {
+    uint64_t largest = 0;
+    for(const auto &bucket: s.buckets) {
+        largest = std::max(largest, bucket.load(std::memory_order_relaxed));
+    }
+    if(largest == 0) {
+        return;
+    }
+
+    for(size_t i = 0; i < stats::bucket_count; ++i) {
+        const auto n = s.buckets[i].load(std::memory_order_relaxed);
+        if(n == 0) {
+            continue;
+        }
+        const auto lower = i == 0 ? 0ns : nanoseconds{uint64_t{1} << (i - 1)};
+        os << std::format("{}>= {: >6}: {: >8} {}\n", std::string(indent, ' '),
+                          durationToHumanString(lower), n, std::string(1 + n * 40 / largest, '#'));
+    }
+}
+
+
+namespace detail {
+struct stats_registry
+{
+    std::mutex                                mutex;
+    std::map<std::string, stats, std::less<>> entries;
+
+    static stats_registry &instance() {
+        static stats_registry registry;
+        return registry;
+    }
+};
+} // namespace detail
+
+
+inline stats &stats_for(std::string_view name) {
+    auto            &registry = detail::stats_registry::instance();
+    std::lock_guard  lock(registry.mutex);
+
+    auto it = registry.entries.find(name);
+    if(it == registry.entries.end()) {
+        it = registry.entries.try_emplace(std::string(name)).first;
+    }
+    return it->second;
+}
+
+
+// Prints all named stats, largest total first.
+inline void report(std::ostream &os = std::cout) {
+    auto           &registry = detail::stats_registry::instance();
+    std::lock_guard lock(registry.mutex);
+
+    std::vector<std::pair<const std::string *, const stats *>> sorted;
+    for(const auto &[name, s]: registry.entries) {
+        sorted.emplace_back(&name, &s);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second->total.load() > rhs.second->total.load();
+    });
+
+    for(const auto &[name, s]: sorted) {
+        os << *name << ": " << *s << "\n";
+    }
+    os << instrumentation_overhead() << "\n";
+}
+
+
+struct aggregate
+{
+    stats                            &target;
+    high_resolution_clock::time_point start;
+
+    aggregate(stats &target)
+        : target(target)
+        , start(high_resolution_clock::now()) {}
+
+    aggregate(std::string_view name)
+        : aggregate(stats_for(name)) {}
+
+    ~aggregate() {
+        target.add(high_resolution_clock::now() - start);
+    }
+};
+
+
+template<uint32_t Every> struct sampled
+{
+    static_assert(Every > 0);
+
+    stats                            *target; // nullptr if this entry is not sampled
+    high_resolution_clock::time_point start;
+
+    sampled(stats &target)
+        : target(pick() ? &target : nullptr) {
+        if(this->target) {
+            start = high_resolution_clock::now();
+        }
+    }
+
+    sampled(std::string_view name)
+        : sampled(stats_for(name)) {}
+
+    ~sampled() {
+        if(target) {
+            target->add(high_resolution_clock::now() - start);
+        }
+    }
+
+private:
+    // xorshift64 per thread; random picks don't alias with periodic patterns of the caller
+    static bool pick() {
+        static thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state <= std::numeric_limits<uint64_t>::max() / Every;
+    }
+};
+
+
+namespace detail {
+// Best of a few rounds, the noise only ever adds time.
+inline nanoseconds best_per_call(auto &&scope) {
+    static constexpr size_t rounds = 5;
+    static constexpr size_t count  = 1000;
+
+    auto best = nanoseconds::max();
+    for(size_t round = 0; round < rounds; ++round) {
+        auto start = high_resolution_clock::now();
+        for(size_t i = 0; i < count; ++i) {
+            scope();
+        }
+        best = std::min(best, duration_cast<nanoseconds>(high_resolution_clock::now() - start));
+    }
+    return best / count;
+}
+
+
+// Runs `measure` outside of the open blocks of type `Block`: the measuring blocks must not become
+// their children, and the time spent here must not be charged to them.
+template<typename Block> auto measure_aside(auto &&measure) {
+    const bool  measuring = std::exchange(measuringOverhead, true);
+    auto *const openBlock = std::exchange(Block::current, nullptr);
+    const auto  begin     = high_resolution_clock::now();
+
+    auto result = measure();
+
+    const auto spent = high_resolution_clock::now() - begin;
+    for(auto *open = openBlock; open; open = open->parent) {
+        open->start += spent;
+    }
+    Block::current    = openBlock;
+    measuringOverhead = measuring;
+    return result;
+}
+
+
+template<typename Block> nanoseconds nested_block_overhead() {
+    return measure_aside<Block>([]() {
+        std::ostream null(nullptr);
+        Block        outer("instrumentation_overhead", null);
+        return best_per_call([&]() { Block b("instrumentation_overhead", null); });
+    });
+}
+} // namespace detail
+
+
+inline const instrumentation_cost &instrumentation_overhead() {
+    static const instrumentation_cost cost = []() {
+        return detail::measure_aside<block<>>([]() {
+            std::ostream         null(nullptr);
+            stats                target;
+            instrumentation_cost result;
+            result.block =
+                detail::best_per_call([&]() { block b("instrumentation_overhead", null); });
+            result.nested_block = detail::nested_block_overhead<block<>>();
+            result.sampled_out  = detail::best_per_call([&]() {
+                sampled<std::numeric_limits<uint32_t>::max()> s(target);
+            });
+            result.aggregate = detail::best_per_call([&]() { aggregate a(target); });
+            return result;
+        });
+    }();
+
+    return cost;
+}
+
+
 }} // namespace tesuji::timed
+
+#undef TESUJI_HAS_RDTSC
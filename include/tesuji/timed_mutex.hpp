@@ -0,0 +1,300 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "timed.hpp"
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <source_location>
+#include <unordered_set>
+
+
+namespace tesuji { namespace timed {
+
+// Provides drop-in wrappers for mutexes that record how long threads waited to acquire them, how
+// long they were held and how often an acquisition was contended. All mutexes constructed at the
+// same source location share one `lock_site`, so a mutex member of a class is reported once for
+// all its instances. Each mutex counts into its own `lock_stats` next to the native mutex, and the
+// site sums them when reported, so mutexes of one site don't share a cache line.
+//      struct lock_stats;
+//      template<typename M = std::mutex> struct mutex;
+//      template<typename M = std::shared_mutex> struct shared_mutex;
+//      lock_site &lock_site_for(std::string_view name);
+//      void lock_report(std::ostream &os = std::cout, bool histograms = false);
+//
+// An uncontended `lock()` costs a `try_lock()`, one clock read and an increment; the wait is only
+// timed when `try_lock()` fails. Hold time is recorded for exclusive ownership only, shared owners
+// are counted and their waits timed. M must not be recursive. Constructing a mutex takes the lock
+// of its site, the site of a source location is looked up once per thread.
+//
+// Example:
+//      timed::mutex<> m;
+//      auto worker = [&]() {
+//          for(int i = 0; i < 1000; ++i) {
+//              std::lock_guard lock(m);
+//              // do stuff
+//          }
+//      };
+//      std::jthread t1(worker), t2(worker);
+//      ...
+//      timed::lock_report();
+// Possible output:
+//      locks by total wait:
+//      main.cpp:12: acquisitions: 2000, contended: 38.2%
+//          wait: count: 764, total:  12ms, avg:  15µs, min: 120ns, max: 310µs
+//          hold: count: 2000, total:  30ms, avg:  15µs, min:  40ns, max:  90µs
+//
+
+
+// What a mutex, or all mutexes of a site, recorded.
+struct lock_stats
+{
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    stats                 wait;
+    stats                 hold;
+
+    double contention_rate() const {
+        const auto n = acquisitions.load(std::memory_order_relaxed);
+        return n == 0 ? 0.0 : double(contended.load(std::memory_order_relaxed)) / double(n);
+    }
+
+    void merge(const lock_stats &other) {
+        acquisitions.fetch_add(other.acquisitions.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        contended.fetch_add(other.contended.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        wait.merge(other.wait);
+        hold.merge(other.hold);
+    }
+};
+
+
+// The mutexes of a site count into their own `lock_stats`, the site only sums them up when it is
+// asked, and keeps the counts of the mutexes destroyed so far.
+struct lock_site
+{
+    std::string name;
+
+    lock_site(std::string name)
+        : name(std::move(name)) {}
+
+    // Adds the counts of all mutexes of this site, destroyed and live, to `into`.
+    void collect(lock_stats &into) const {
+        std::lock_guard lock(m_mutex);
+        into.merge(m_retired);
+        for(const lock_stats *live: m_live) {
+            into.merge(*live);
+        }
+    }
+
+    void attach(const lock_stats &live) {
+        std::lock_guard lock(m_mutex);
+        m_live.insert(&live);
+    }
+
+    void detach(const lock_stats &live) {
+        std::lock_guard lock(m_mutex);
+        m_retired.merge(live);
+        m_live.erase(&live);
+    }
+
+private:
+    mutable std::mutex                    m_mutex;
+    lock_stats                            m_retired;
+    std::unordered_set<const lock_stats *> m_live;
+};
+
+
+namespace detail {
+struct lock_registry
+{
+    std::mutex            mutex;
+    std::deque<lock_site> sites; // deque keeps references stable
+
+    static lock_registry &instance() {
+        static lock_registry registry;
+        return registry;
+    }
+};
+
+
+inline std::string site_name(const std::source_location &loc) {
+    std::string_view file = loc.file_name();
+    if(auto pos = file.find_last_of("/\\"); pos != std::string_view::npos) {
+        file.remove_prefix(pos + 1);
+    }
+    return std::format("{}:{}", file, loc.line());
+}
+} // namespace detail
+
+
+inline lock_site &lock_site_for(std::string_view name) {
+    auto           &registry = detail::lock_registry::instance();
+    std::lock_guard lock(registry.mutex);
+
+    for(auto &site: registry.sites) {
+        if(site.name == name) {
+            return site;
+        }
+    }
+    return registry.sites.emplace_back(std::string(name));
+}
+
+
+namespace detail {
+// Sites are never removed, so every thread can remember the ones it looked up. The file name of a
+// source_location points to a string literal, its address identifies the file.
+inline lock_site &lock_site_for(const std::source_location &loc) {
+    thread_local std::map<std::pair<const char *, uint_least32_t>, lock_site *> cache;
+
+    lock_site *&site = cache[{loc.file_name(), loc.line()}];
+    if(!site) {
+        site = &timed::lock_site_for(site_name(loc));
+    }
+    return *site;
+}
+} // namespace detail
+
+
+// Prints all lock sites, the one with the largest total wait time first.
+inline void lock_report(std::ostream &os = std::cout, bool histograms = false) {
+    auto           &registry = detail::lock_registry::instance();
+    std::lock_guard lock(registry.mutex);
+
+    std::deque<lock_stats>                                   sums(registry.sites.size());
+    std::vector<std::pair<const lock_site *, lock_stats *>> sorted;
+    for(const auto &site: registry.sites) {
+        sorted.emplace_back(&site, &sums[sorted.size()]);
+        site.collect(*sorted.back().second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second->wait.total.load() > rhs.second->wait.total.load();
+    });
+
+    os << "locks by total wait:\n";
+    for(const auto &[site, sum]: sorted) {
+        os << std::format("{}: acquisitions: {}, contended: {:.1f}%\n", site->name,
+                          sum->acquisitions.load(), 100.0 * sum->contention_rate());
+        os << "    wait: " << sum->wait << "\n";
+        if(histograms) {
+            print_histogram(os, sum->wait, 8);
+        }
+        os << "    hold: " << sum->hold << "\n";
+        if(histograms) {
+            print_histogram(os, sum->hold, 8);
+        }
+    }
+}
+
+
+template<typename M = std::mutex> struct mutex
+{
+    using native_type = M;
+
+    mutex(std::source_location loc = std::source_location::current())
+        : m_site(&detail::lock_site_for(loc)) {
+        m_site->attach(m_stats);
+    }
+
+    mutex(std::string_view name)
+        : m_site(&lock_site_for(name)) {
+        m_site->attach(m_stats);
+    }
+
+    mutex(const mutex &)            = delete;
+    mutex &operator=(const mutex &) = delete;
+
+    ~mutex() {
+        m_site->detach(m_stats);
+    }
+
+    void lock() {
+        if(m_mutex.try_lock()) {
+            m_holdStart = high_resolution_clock::now();
+        } else {
+            auto start = high_resolution_clock::now();
+            m_mutex.lock();
+            m_holdStart = high_resolution_clock::now();
+            m_stats.wait.add(m_holdStart - start);
+            m_stats.contended.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if(!m_mutex.try_lock()) {
+            return false;
+        }
+        m_holdStart = high_resolution_clock::now();
+        m_stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        auto held = high_resolution_clock::now() - m_holdStart;
+        m_mutex.unlock();
+        m_stats.hold.add(held);
+    }
+
+    M &native() {
+        return m_mutex;
+    }
+
+    lock_site &site() const {
+        return *m_site;
+    }
+
+    // The counts of this mutex only.
+    const lock_stats &own_stats() const {
+        return m_stats;
+    }
+
+protected:
+    M                                 m_mutex;
+    lock_site                        *m_site;
+    lock_stats                        m_stats;
+    high_resolution_clock::time_point m_holdStart;
+};
+
+
+template<typename M = std::shared_mutex> struct shared_mutex : mutex<M>
+{
+    // not inherited, the default source location would be the one of the inheriting constructor
+    shared_mutex(std::source_location loc = std::source_location::current())
+        : mutex<M>(loc) {}
+
+    shared_mutex(std::string_view name)
+        : mutex<M>(name) {}
+
+    void lock_shared() {
+        if(!this->m_mutex.try_lock_shared()) {
+            auto start = high_resolution_clock::now();
+            this->m_mutex.lock_shared();
+            this->m_stats.wait.add(high_resolution_clock::now() - start);
+            this->m_stats.contended.fetch_add(1, std::memory_order_relaxed);
+        }
+        this->m_stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock_shared() {
+        if(!this->m_mutex.try_lock_shared()) {
+            return false;
+        }
+        this->m_stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock_shared() {
+        this->m_mutex.unlock_shared();
+    }
+};
+
+
+}} // namespace tesuji::timed
@@ -0,0 +1,420 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "symbolize.hpp"
+#include "timed.hpp"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#if defined(__linux__) && defined(__ELF__)
+#    include <dlfcn.h>
+#    include <elf.h>
+#    include <link.h>
+#    include <sys/mman.h>
+#    define TESUJI_HAS_INIT_ARRAY 1
+#else
+#    define TESUJI_HAS_INIT_ARRAY 0
+#endif
+
+
+namespace tesuji { namespace timed {
+
+// Provides a profile of process startup: the time from exec to main, how long the dynamic loader
+// took to map and relocate the shared libraries, and the time spent in every static initializer
+// of the executable and its libraries.
+//      startup_profile profile_startup();
+//      void startup_report(std::ostream &os = std::cout, size_t top = 10);
+//
+// Define TESUJI_PROFILE_STARTUP in exactly one translation unit of the executable before including
+// this header. That adds a `.preinit_array` entry, which runs before any library initializer, and
+// replaces every `.init_array` entry of the loaded modules with a trampoline that times the
+// original. The compiler emits one initializer per translation unit with dynamically initialized
+// globals (`_GLOBAL__sub_I_<file>`), plus one per `__attribute__((constructor))` function. Names
+// come from the symbol table of the module file, so strip your binaries after profiling.
+//
+// Function-local statics, like the regexes in container_io.hpp, are initialized on first use and
+// are not part of startup. Use `cold_calls()` to see what that first use costs.
+//
+// The process start time comes from /proc/self/stat in clock ticks, so the loader and exec to main
+// times are only accurate to about 10ms. Main is taken to start when the last initializer returns,
+// the time until `profile_startup()` is called isn't counted. Linux only, elsewhere the profile is
+// empty.
+//
+// The loader time is not split by library: all libraries are mapped and relocated before the first
+// code of the program runs, and timing each one would take an LD_AUDIT library of its own. Instead
+// every library lists the relocations the loader processed for it, read from the sizes in its
+// dynamic section, which is most of the loader's work for a large library. Packed relative
+// relocations (DT_RELR) are not counted.
+//
+// Example:
+//      #define TESUJI_PROFILE_STARTUP
+//      #include "tesuji/timed_startup.hpp"
+//
+//      int main() {
+//          if(getenv("APP_STARTUP")) {
+//              timed::startup_report(std::cerr);
+//          }
+//          ...
+//      }
+// Possible output:
+//      startup: 31ms from exec to main
+//          loader: 10ms, 6 libraries mapped and relocated
+//          initializers: 19ms in 14 functions
+//      libraries by initializer time:
+//          app: 18ms, 9 initializers
+//          libstdc++.so.6: 110µs, 2 initializers
+//          libc.so.6: 12µs, 1 initializers
+//      libraries by relocations:
+//          libstdc++.so.6: 14721 relocations
+//          app: 3410 relocations
+//          libc.so.6: 1572 relocations
+//      slowest initializers:
+//          app: _GLOBAL__sub_I_config.cpp: 17ms
+//          app: _GLOBAL__sub_I_main.cpp: 900µs
+//          libstdc++.so.6: _GLOBAL__sub_I_eh_alloc.cc: 95µs
+//
+
+
+struct startup_initializer
+{
+    std::string module;
+    std::string symbol;
+    nanoseconds time;
+};
+
+
+struct startup_library
+{
+    std::string name;
+    nanoseconds init{};
+    size_t      initializers = 0;
+    size_t      relocations  = 0; // processed by the loader
+};
+
+
+struct startup_profile
+{
+    bool        enabled = false;
+    nanoseconds loader{};       // exec to the first initializer
+    nanoseconds initializers{}; // sum over all initializers
+    nanoseconds to_main{};      // exec to the end of the last initializer
+    size_t      libraries_loaded = 0;
+
+    std::vector<startup_library>     libraries; // all loaded, largest initializer time first
+    std::vector<startup_initializer> slowest;   // all initializers, slowest first
+};
+
+
+#if TESUJI_HAS_INIT_ARRAY
+namespace detail { namespace startup {
+using init_fn = void (*)(int, char **, char **);
+
+inline constexpr size_t max_initializers = 512;
+inline constexpr size_t max_modules      = 128;
+
+// Everything here is written before the dynamic initialization of this program runs, so it must be
+// constant initialized.
+struct entry
+{
+    init_fn  original;
+    uint32_t module;
+    int64_t  start;
+    int64_t  end;
+};
+
+struct module
+{
+    const char *name;
+    uintptr_t   base;
+};
+
+inline constinit entry   entries[max_initializers]{};
+inline constinit module  modules[max_modules]{};
+inline constinit size_t  entryCount  = 0;
+inline constinit size_t  moduleCount = 0;
+inline constinit int64_t preinitTime = 0;
+
+
+inline int64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+
+template<size_t I> void trampoline(int argc, char **argv, char **envp) {
+    entries[I].start = now();
+    entries[I].original(argc, argv, envp);
+    entries[I].end = now();
+}
+
+template<size_t... I>
+constexpr std::array<init_fn, sizeof...(I)> make_trampolines(std::index_sequence<I...>) {
+    return {&trampoline<I>...};
+}
+
+inline constexpr auto trampolines = make_trampolines(std::make_index_sequence<max_initializers>{});
+
+
+inline int wrap_module(dl_phdr_info *info, size_t, void *) {
+    const ElfW(Phdr) *dynamic = nullptr;
+    const ElfW(Phdr) *relro   = nullptr;
+    for(size_t i = 0; i < info->dlpi_phnum; ++i) {
+        if(info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+            dynamic = &info->dlpi_phdr[i];
+        } else if(info->dlpi_phdr[i].p_type == PT_GNU_RELRO) {
+            relro = &info->dlpi_phdr[i];
+        }
+    }
+    if(!dynamic || moduleCount == max_modules) {
+        return 0;
+    }
+
+    uintptr_t array = 0;
+    size_t    size  = 0;
+    for(auto *dyn = (const ElfW(Dyn) *)(info->dlpi_addr + dynamic->p_vaddr); dyn->d_tag != DT_NULL;
+        ++dyn) {
+        if(dyn->d_tag == DT_INIT_ARRAY) {
+            array = dyn->d_un.d_ptr;
+        } else if(dyn->d_tag == DT_INIT_ARRAYSZ) {
+            size = dyn->d_un.d_val;
+        }
+    }
+    if(array == 0 || size == 0) {
+        return 0;
+    }
+
+    // the array is read-only after relocation when it lies in the RELRO segment
+    const bool inRelro =
+        relro && array >= relro->p_vaddr && array < relro->p_vaddr + relro->p_memsz;
+    const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t first    = (info->dlpi_addr + array) & ~(pageSize - 1);
+    const uintptr_t last     = info->dlpi_addr + array + size;
+    if(inRelro && mprotect((void *)first, last - first, PROT_READ | PROT_WRITE) != 0) {
+        return 0;
+    }
+
+    const uint32_t moduleIndex = uint32_t(moduleCount++);
+    modules[moduleIndex]       = {info->dlpi_name, info->dlpi_addr};
+
+    auto *fns = (init_fn *)(info->dlpi_addr + array);
+    for(size_t i = 0; i < size / sizeof(init_fn) && entryCount < max_initializers; ++i) {
+        // 0 and -1 are placeholders some linkers leave in the array
+        if(fns[i] == nullptr || uintptr_t(fns[i]) == uintptr_t(-1)) {
+            continue;
+        }
+        entries[entryCount] = {fns[i], moduleIndex, 0, 0};
+        fns[i]              = trampolines[entryCount++];
+    }
+
+    if(inRelro) {
+        mprotect((void *)first, last - first, PROT_READ);
+    }
+    return 0;
+}
+
+
+// Runs from .preinit_array, after all modules are relocated and before their initializers.
+inline void install(int, char **, char **) {
+    if(preinitTime != 0) {
+        return;
+    }
+    preinitTime = now();
+    dl_iterate_phdr(&wrap_module, nullptr);
+}
+
+
+// The relocations the loader processes for a module, from the sizes in its dynamic section.
+inline size_t relocation_count(const dl_phdr_info *info) {
+    const ElfW(Phdr) *dynamic = nullptr;
+    for(size_t i = 0; i < info->dlpi_phnum; ++i) {
+        if(info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+            dynamic = &info->dlpi_phdr[i];
+        }
+    }
+    if(!dynamic) {
+        return 0;
+    }
+
+    size_t rela    = 0;
+    size_t relaEnt = sizeof(ElfW(Rela));
+    size_t rel     = 0;
+    size_t relEnt  = sizeof(ElfW(Rel));
+    size_t plt     = 0;
+    size_t pltType = DT_RELA;
+    for(auto *dyn = (const ElfW(Dyn) *)(info->dlpi_addr + dynamic->p_vaddr); dyn->d_tag != DT_NULL;
+        ++dyn) {
+        switch(dyn->d_tag) {
+        case DT_RELASZ: rela = dyn->d_un.d_val; break;
+        case DT_RELAENT: relaEnt = dyn->d_un.d_val; break;
+        case DT_RELSZ: rel = dyn->d_un.d_val; break;
+        case DT_RELENT: relEnt = dyn->d_un.d_val; break;
+        case DT_PLTRELSZ: plt = dyn->d_un.d_val; break;
+        case DT_PLTREL: pltType = dyn->d_un.d_val; break;
+        }
+    }
+    auto entries = [](size_t size, size_t entrySize) {
+        return entrySize == 0 ? 0 : size / entrySize;
+    };
+    return entries(rela, relaEnt) + entries(rel, relEnt)
+         + entries(plt, pltType == DT_RELA ? relaEnt : relEnt);
+}
+
+
+inline std::string module_name(const module &m) {
+    return (m.name && *m.name) ? tesuji::detail::module_name(m.name)
+                               : std::string(program_invocation_short_name);
+}
+
+
+// Boot-relative start of this process from /proc/self/stat, in nanoseconds.
+inline int64_t process_start() {
+    std::ifstream     in("/proc/self/stat");
+    std::string       line;
+    std::getline(in, line);
+    auto              pos = line.rfind(')');
+    std::stringstream fields(pos == std::string::npos ? std::string() : line.substr(pos + 2));
+
+    // starttime is field 22, the state after the command name is field 3
+    std::string field;
+    for(int i = 3; i <= 22 && fields >> field; ++i) {}
+    const long ticks = sysconf(_SC_CLK_TCK);
+    return ticks > 0 && !field.empty() ? int64_t(std::stoll(field)) * (1'000'000'000 / ticks) : 0;
+}
+}} // namespace detail::startup
+
+
+#    if defined(TESUJI_PROFILE_STARTUP)
+namespace detail { namespace startup {
+[[gnu::used, gnu::section(".preinit_array")]] static init_fn preinitHook = &install;
+}} // namespace detail::startup
+#    endif
+#endif
+
+
+inline startup_profile profile_startup() {
+    startup_profile profile;
+#if TESUJI_HAS_INIT_ARRAY
+    using namespace detail::startup;
+    if(preinitTime == 0) {
+        return profile;
+    }
+
+    // the initializers of the executable run last, main follows the end of the last one
+    int64_t mainTime = preinitTime;
+    for(size_t i = 0; i < entryCount; ++i) {
+        mainTime = std::max(mainTime, entries[i].end);
+    }
+    const int64_t start = process_start();
+    profile.enabled     = true;
+    profile.loader      = nanoseconds(start ? std::max<int64_t>(preinitTime - start, 0) : 0);
+    profile.to_main     = nanoseconds(start ? mainTime - start : 0);
+
+    // by base address, which is what the initializers know their module by
+    std::map<uintptr_t, startup_library> libraries;
+    dl_iterate_phdr(
+        [](dl_phdr_info *info, size_t, void *out) {
+            auto &lib       = (*(std::map<uintptr_t, startup_library> *)out)[info->dlpi_addr];
+            lib.name        = module_name({info->dlpi_name, info->dlpi_addr});
+            lib.relocations = relocation_count(info);
+            return 0;
+        },
+        &libraries);
+    // the executable and the vdso
+    profile.libraries_loaded = libraries.size() - std::min<size_t>(libraries.size(), 2);
+
+    for(size_t i = 0; i < entryCount; ++i) {
+        const entry &e = entries[i];
+        if(e.start == 0 || e.end == 0) {
+            continue; // ran before we got here, or not at all yet
+        }
+
+        const module &m    = modules[e.module];
+        auto         &lib  = libraries[m.base];
+        const auto    time = nanoseconds(e.end - e.start);
+        lib.name           = module_name(m);
+        lib.init          += time;
+        ++lib.initializers;
+        profile.initializers += time;
+
+        std::string symbol;
+        Dl_info     info;
+        if(dladdr((void *)e.original, &info) && info.dli_sname
+           && info.dli_saddr == (void *)e.original) {
+            symbol = tesuji::detail::demangle(info.dli_sname);
+        } else {
+            const std::string path   = (m.name && *m.name) ? m.name : "/proc/self/exe";
+            const uintptr_t   offset = uintptr_t(e.original) - m.base;
+            auto [name, start]       = tesuji::detail::symbols_of(path).find(offset);
+            symbol = name ? tesuji::detail::demangle(name) : std::format("{:#x}", offset);
+        }
+        profile.slowest.push_back({lib.name, std::move(symbol), time});
+    }
+
+    for(auto &[base, lib]: libraries) {
+        if(lib.initializers > 0 || lib.relocations > 0) {
+            profile.libraries.push_back(std::move(lib));
+        }
+    }
+    std::stable_sort(profile.libraries.begin(), profile.libraries.end(),
+                     [](const auto &lhs, const auto &rhs) { return lhs.init > rhs.init; });
+    std::stable_sort(profile.slowest.begin(), profile.slowest.end(),
+                     [](const auto &lhs, const auto &rhs) { return lhs.time > rhs.time; });
+#endif
+    return profile;
+}
+
+
+inline void startup_report(std::ostream &os = std::cout, size_t top = 10) {
+    const startup_profile profile = profile_startup();
+    if(!profile.enabled) {
+        os << "startup: not profiled, define TESUJI_PROFILE_STARTUP in one source file\n";
+        return;
+    }
+
+    os << std::format("startup: {} from exec to main\n", durationToHumanString(profile.to_main));
+    os << std::format("    loader: {}, {} libraries mapped and relocated\n",
+                      durationToHumanString(profile.loader), profile.libraries_loaded);
+    os << std::format("    initializers: {} in {} functions\n",
+                      durationToHumanString(profile.initializers), profile.slowest.size());
+
+    os << "libraries by initializer time:\n";
+    for(const auto &lib: profile.libraries) {
+        if(lib.initializers > 0) {
+            os << std::format("    {}: {}, {} initializers\n", lib.name,
+                              durationToHumanString(lib.init), lib.initializers);
+        }
+    }
+
+    std::vector<const startup_library *> byRelocations;
+    for(const auto &lib: profile.libraries) {
+        byRelocations.push_back(&lib);
+    }
+    std::stable_sort(byRelocations.begin(), byRelocations.end(),
+                     [](const auto *lhs, const auto *rhs) {
+                         return lhs->relocations > rhs->relocations;
+                     });
+    os << "libraries by relocations:\n";
+    for(size_t i = 0; i < std::min(top, byRelocations.size()); ++i) {
+        os << std::format("    {}: {} relocations\n", byRelocations[i]->name,
+                          byRelocations[i]->relocations);
+    }
+
+    os << "slowest initializers:\n";
+    for(size_t i = 0; i < std::min(top, profile.slowest.size()); ++i) {
+        const auto &init = profile.slowest[i];
+        os << std::format("    {}: {}: {}\n", init.module, init.symbol,
+                          durationToHumanString(init.time));
+    }
+}
+
+
+}} // namespace tesuji::timed
+
+#undef TESUJI_HAS_INIT_ARRAY
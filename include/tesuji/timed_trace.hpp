@@ -0,0 +1,357 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "benchmark.hpp"
+
+#include <condition_variable>
+#include <stop_token>
+#include <thread>
+
+#if defined(__linux__)
+#    include <dirent.h>
+#    include <sys/resource.h>
+#    define TESUJI_HAS_PROCFS 1
+#else
+#    define TESUJI_HAS_PROCFS 0
+#endif
+
+
+namespace tesuji { namespace timed {
+
+// Provides spans that are recorded to a trace in the Chrome trace event format, which
+// chrome://tracing and https://ui.perfetto.dev display as a timeline per thread.
+//      struct span;
+//      void trace_start();
+//      void trace_stop();
+//      void write_trace(std::ostream &os, const telemetry *sampler = nullptr);
+//
+// Spans are only recorded when they start and end between `trace_start()` and `trace_stop()`. Only
+// a span that is recorded copies its name, otherwise a span costs two clock reads.
+//
+// Also provides a background thread that samples process metrics at a fixed interval into a ring
+// buffer: CPU usage, RSS, PSS, threads, open file descriptors and major page faults.
+//      struct telemetry;
+//
+// Pass it to `write_trace()` to get its samples as counter tracks on the same timeline as the
+// spans, so a memory spike or a saturated CPU lines up with the span that caused it. PSS is read
+// from /proc/self/smaps_rollup, which walks the page tables, so set `pss = false` for processes
+// with very large mappings. The metrics are Linux only, elsewhere only the time is sampled.
+//
+// Example:
+//      timed::telemetry sampler(10ms);
+//      timed::trace_start();
+//      {
+//          timed::span s("load");
+//          load();
+//      }
+//      timed::trace_stop();
+//      std::ofstream out("trace.json");
+//      timed::write_trace(out, &sampler);
+// Possible output:
+//      {"traceEvents": [
+//      {"name": "load", "ph": "X", "ts": 5.2, "dur": 183220.7, "pid": 1, "tid": 1},
+//      {"name": "cpu %", "ph": "C", "ts": 0.0, "pid": 1, "args": {"cpu %": 0}},
+//      {"name": "memory MiB", "ph": "C", "ts": 0.0, "pid": 1, "args": {"rss": 4.1, "pss": 3.2}},
+//      ...
+//
+
+
+namespace detail {
+inline std::chrono::steady_clock::time_point trace_epoch() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+
+inline nanoseconds trace_now() {
+    return duration_cast<nanoseconds>(std::chrono::steady_clock::now() - trace_epoch());
+}
+
+
+inline uint32_t trace_thread_id() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t        id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+
+struct span_event
+{
+    std::string name;
+    nanoseconds start;
+    nanoseconds duration;
+    uint32_t    thread;
+};
+
+
+struct trace_buffer
+{
+    std::atomic<bool>       enabled{false};
+    std::mutex              mutex;
+    std::vector<span_event> events;
+
+    static trace_buffer &instance() {
+        static trace_buffer buffer;
+        return buffer;
+    }
+};
+} // namespace detail
+
+
+// Starts recording spans, the ones recorded before are kept.
+inline void trace_start() {
+    detail::trace_epoch();
+    detail::trace_buffer::instance().enabled.store(true, std::memory_order_relaxed);
+}
+
+
+inline void trace_stop() {
+    detail::trace_buffer::instance().enabled.store(false, std::memory_order_relaxed);
+}
+
+
+struct span
+{
+    std::string name; // empty unless tracing when constructed
+    nanoseconds start;
+    bool        recording;
+
+    span(std::string_view name)
+        : start(detail::trace_now())
+        , recording(detail::trace_buffer::instance().enabled.load(std::memory_order_relaxed)) {
+        if(recording) {
+            this->name = name;
+        }
+    }
+
+    span(const span &)            = delete;
+    span &operator=(const span &) = delete;
+
+    ~span() {
+        const auto end    = detail::trace_now();
+        auto      &buffer = detail::trace_buffer::instance();
+        if(!recording || !buffer.enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard lock(buffer.mutex);
+        buffer.events.push_back({std::move(name), start, end - start, detail::trace_thread_id()});
+    }
+};
+
+
+struct telemetry_sample
+{
+    nanoseconds time;             // since the start of the trace
+    double      cpu_percent  = 0; // over the interval before, may exceed 100 with many threads
+    uint64_t    rss          = 0; // bytes
+    uint64_t    pss          = 0; // bytes
+    uint32_t    threads      = 0;
+    uint32_t    fds          = 0;
+    uint64_t    major_faults = 0; // since process start
+};
+
+
+namespace detail {
+#if TESUJI_HAS_PROCFS
+inline uint64_t read_pss() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string   line;
+    while(std::getline(in, line)) {
+        if(line.starts_with("Pss:")) {
+            return std::stoull(line.substr(4)) * 1024;
+        }
+    }
+    return 0;
+}
+
+
+inline uint32_t count_fds() {
+    DIR *dir = opendir("/proc/self/fd");
+    if(!dir) {
+        return 0;
+    }
+    uint32_t count = 0;
+    while(const dirent *entry = readdir(dir)) {
+        count += entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return count - (count > 0); // the one opendir holds
+}
+#endif
+
+
+inline nanoseconds process_cpu_time() {
+#if defined(CLOCK_PROCESS_CPUTIME_ID)
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+#else
+    return duration_cast<nanoseconds>(
+        std::chrono::duration<double>(double(std::clock()) / CLOCKS_PER_SEC));
+#endif
+}
+} // namespace detail
+
+
+struct telemetry
+{
+    nanoseconds interval;
+    bool        pss;
+
+    // Starts sampling right away and keeps the last `capacity` samples.
+    telemetry(nanoseconds interval = 100ms, size_t capacity = 4096, bool pss = true)
+        : interval(interval)
+        , pss(pss)
+        , m_ring(std::max<size_t>(capacity, 1)) {
+        detail::trace_epoch();
+        m_lastCpu  = detail::process_cpu_time();
+        m_lastTime = detail::trace_now();
+        m_thread   = std::jthread([this](std::stop_token stop) { run(stop); });
+    }
+
+    telemetry(const telemetry &)            = delete;
+    telemetry &operator=(const telemetry &) = delete;
+
+    ~telemetry() {
+        stop();
+    }
+
+    void stop() {
+        if(m_thread.joinable()) {
+            m_thread.request_stop();
+            m_wakeup.notify_all();
+            m_thread.join();
+        }
+    }
+
+    // The samples in the ring buffer, oldest first.
+    std::vector<telemetry_sample> samples() const {
+        std::lock_guard               lock(m_mutex);
+        std::vector<telemetry_sample> result;
+        const size_t                  n = std::min(m_count, m_ring.size());
+        for(size_t i = m_count - n; i < m_count; ++i) {
+            result.push_back(m_ring[i % m_ring.size()]);
+        }
+        return result;
+    }
+
+private:
+    telemetry_sample sample() {
+        telemetry_sample s{detail::trace_now()};
+
+        const auto cpu = detail::process_cpu_time();
+        if(s.time > m_lastTime) {
+            s.cpu_percent = 100.0 * double((cpu - m_lastCpu).count())
+                          / double((s.time - m_lastTime).count());
+        }
+        m_lastCpu  = cpu;
+        m_lastTime = s.time;
+
+#if TESUJI_HAS_PROCFS
+        const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+        std::ifstream  statm("/proc/self/statm");
+        uint64_t       size = 0, resident = 0;
+        if(statm >> size >> resident) {
+            s.rss = resident * pageSize;
+        }
+
+        // majflt is field 12 and num_threads field 20, the state after the command name is field 3
+        std::ifstream stat("/proc/self/stat");
+        std::string   line;
+        std::getline(stat, line);
+        if(auto pos = line.rfind(')'); pos != std::string::npos) {
+            std::stringstream fields(line.substr(pos + 2));
+            std::string       field;
+            for(int i = 3; i <= 20 && fields >> field; ++i) {
+                if(i == 12) {
+                    s.major_faults = std::stoull(field);
+                } else if(i == 20) {
+                    s.threads = uint32_t(std::stoul(field));
+                }
+            }
+        }
+
+        s.fds = detail::count_fds();
+        if(pss) {
+            s.pss = detail::read_pss();
+        }
+#endif
+        return s;
+    }
+
+    void run(std::stop_token stop) {
+        std::mutex       waitMutex;
+        std::unique_lock waitLock(waitMutex);
+        while(!stop.stop_requested()) {
+            auto s = sample();
+            {
+                std::lock_guard lock(m_mutex);
+                m_ring[m_count++ % m_ring.size()] = s;
+            }
+            m_wakeup.wait_for(waitLock, stop, interval, []() { return false; });
+        }
+    }
+
+    mutable std::mutex            m_mutex;
+    std::vector<telemetry_sample> m_ring;
+    size_t                        m_count = 0;
+    nanoseconds                   m_lastCpu{};
+    nanoseconds                   m_lastTime{};
+    std::condition_variable_any   m_wakeup;
+    std::jthread                  m_thread;
+};
+
+
+// Writes all recorded spans and, if given, the samples of `sampler` as counter tracks.
+inline void write_trace(std::ostream &os, const telemetry *sampler = nullptr) {
+    using detail::json_number;
+    auto micros = [](nanoseconds d) { return json_number(double(d.count()) / 1000.0); };
+
+    os << "{\"traceEvents\": [\n";
+    const char *separator = "";
+    {
+        auto           &buffer = detail::trace_buffer::instance();
+        std::lock_guard lock(buffer.mutex);
+        for(const auto &event: buffer.events) {
+            os << std::format("{}{{\"name\": \"{}\", \"ph\": \"X\", \"ts\": {}, \"dur\": {}, "
+                              "\"pid\": 1, \"tid\": {}}}",
+                              separator, detail::json_escape(event.name), micros(event.start),
+                              micros(event.duration), event.thread);
+            separator = ",\n";
+        }
+    }
+
+    if(sampler) {
+        auto counter = [&](std::string_view name, nanoseconds time, std::string_view args) {
+            os << std::format("{}{{\"name\": \"{}\", \"ph\": \"C\", \"ts\": {}, \"pid\": 1, "
+                              "\"args\": {{{}}}}}",
+                              separator, name, micros(time), args);
+            separator = ",\n";
+        };
+
+        const auto samples = sampler->samples();
+        for(size_t i = 0; i < samples.size(); ++i) {
+            const auto &s   = samples[i];
+            const auto  mib = [](uint64_t bytes) { return json_number(double(bytes) / (1 << 20)); };
+            counter("cpu %", s.time, std::format("\"cpu %\": {}", json_number(s.cpu_percent)));
+            counter("memory MiB", s.time,
+                    sampler->pss ? std::format("\"rss\": {}, \"pss\": {}", mib(s.rss), mib(s.pss))
+                                 : std::format("\"rss\": {}", mib(s.rss)));
+            counter("threads", s.time, std::format("\"threads\": {}", s.threads));
+            counter("fds", s.time, std::format("\"fds\": {}", s.fds));
+            // per interval, so that a burst of faults stands out
+            const uint64_t faults = i == 0 ? 0 : s.major_faults - samples[i - 1].major_faults;
+            counter("major faults", s.time, std::format("\"major faults\": {}", faults));
+        }
+    }
+    os << "\n]}\n";
+}
+
+
+}} // namespace tesuji::timed
+
+#undef TESUJI_HAS_PROCFS
@@ -5,131 +5,1514 @@
 // See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
 // github.com/sudosandwich/tesuji
 
+#include "arena.hpp"
+#include "symbolize.hpp"
 #include "version.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <compare>
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <source_location>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUG__)
+#    include <cxxabi.h>
+#endif
+
+// How many frames of the allocating stack B and D keep for the leak report, see set_stack_depth().
+#ifndef TESUJI_TRACKED_STACK_DEPTH
+#    define TESUJI_TRACKED_STACK_DEPTH 16
+#endif
+
+#if defined(__has_include) && __has_include(<execinfo.h>)
+#    include <execinfo.h>
+#    define TESUJI_HAS_BACKTRACE 1
+#else
+#    define TESUJI_HAS_BACKTRACE 0
+#endif
+
+// Define as 0 to start without the copy audit, see set_copy_audit().
+#ifndef TESUJI_TRACKED_COPY_AUDIT
+#    define TESUJI_TRACKED_COPY_AUDIT 1
+#endif
+
+// Define as 0 to give B and D move operations that may throw, so that containers copy them.
+#ifndef TESUJI_TRACKED_NOEXCEPT_MOVE
+#    define TESUJI_TRACKED_NOEXCEPT_MOVE 1
+#endif
+
+// Define as 0 to start without reporting copies that should have been moves, see
+// set_move_diagnostics().
+#ifndef TESUJI_TRACKED_MOVE_DIAGNOSTICS
+#    define TESUJI_TRACKED_MOVE_DIAGNOSTICS 1
+#endif
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#    define TESUJI_RETURN_ADDRESS() _ReturnAddress()
+#else
+#    define TESUJI_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+// Define as 1 to start with B and D in silent mode.
+#ifndef TESUJI_TRACKED_SILENT
+#    define TESUJI_TRACKED_SILENT 0
+#endif
 
 
 namespace tesuji::tracked {
 
-// Namespace tracked provides the following classes to aid understanding
-// when objects are constructed and destroyed, copied, moved and so on.
-// It is also important to see how memory leaks can occur, so at the end
-// of the program a list of leaked objects is printed.
-//
-// The following classes are provided:
-//    struct B;     // base class, virtual destructor
-//    struct D : B; // derived class
-//
-//
-// Example:
-//    int main() {
-//      auto* p = new tesuji::tracked::D;
-//      auto* q = new tesuji::tracked::B;
-//      *q = *p;
-//      delete p;
-//    }
-//
-// Possible output:
-//    new(D) B0() D0() new(B) B1() B0=B1(&) ~D0() ~B0() delete(D) leaked
-//    objects: B1(0x00000138012C0560)
-//
+// Namespace tracked provides the following classes to aid understanding
+// when objects are constructed and destroyed, copied, moved and so on.
+// It is also important to see how memory leaks can occur, so at the end
+// of the program a list of leaked objects is printed.
+//
+// The following classes are provided:
+//    struct B;     // base class, virtual destructor
+//    struct D : B; // derived class
+//    template<typename T, bool NothrowMove, bool Relocatable> struct value; // wraps a T, counts
+//        its lifecycle per type
+//    template<typename T> struct is_trivially_relocatable;
+//    template<typename T> T *relocate(T *first, T *last, T *dest);
+//
+// The classes can be used from several threads and deleted by another thread than the one that
+// created them. Each thread tracks its allocations separately, the leak report merges them.
+// The output of concurrent threads interleaves.
+//
+// Example:
+//    int main() {
+//      auto* p = new tesuji::tracked::D;
+//      auto* q = new tesuji::tracked::B;
+//      *q = *p;
+//      delete p;
+//    }
+//
+// Possible output:
+//    new(D) B0() D0() new(B) B1() B0=B1(&) ~D0() ~B0() delete(D) leaked
+//    objects: B1(0x00000138012C0560)
+//    leaks by allocation stack:
+//        1 leak, 16 bytes: B1
+//            main+0x3c (app)
+//            __libc_start_call_main+0x7a (libc.so.6)
+//
+// Every allocation of B and D keeps the return addresses of its call stack, 16 frames unless
+// set_stack_depth() or TESUJI_TRACKED_STACK_DEPTH say otherwise. Equal stacks are stored once and
+// only symbolized for the leak report, which groups the leaks by stack.
+//
+// B and D get their memory from malloc, or from the `std::pmr::memory_resource` given to
+// `set_backing_resource()` or a `backing_scope`: an arena, a pool or a page_resource of arena.hpp.
+// Each object remembers its resource and is freed by it, the leak tracking stays the same.
+// examples/backing_allocators.cpp compares them on one workload.
+//
+// Example:
+//    tesuji::pool blocks(64);
+//    tracked::backing_scope scope(&blocks);
+//    auto *d = new tracked::D; // from the pool
+//    delete d;                 // back to the pool
+//
+// `value<T>` forwards to a real T and silently counts default constructions, constructions from
+// arguments, copies, moves, assignments and destructions. It is noexcept wherever T is, so
+// containers treat it like T. The counters are atomic and shared by all value<T> of one T.
+//
+// Example:
+//    std::vector<tracked::value<std::string>> v;
+//    for(int i = 0; i < 5; ++i) {
+//        v.emplace_back("message");
+//    }
+//    std::cout << tracked::value<std::string>::counts() << "\n";
+//
+// Possible output:
+//    default: 0, constructed: 5, copied: 0, moved: 7, copy assigned: 0, move assigned: 0,
+//    destroyed: 7, live: 5
+//
+// B and D count the same events, plus their class operator new and delete. Printing every event
+// is too slow for loops, so `set_silent()`, a `silent_scope` or defining TESUJI_TRACKED_SILENT as 1
+// turns it off. `take_snapshot()` reads the counters of all types, the difference of two
+// snapshots is what happened in between, which is what tests assert on.
+//
+// Example:
+//    tracked::set_silent();
+//    std::vector<tracked::value<Msg>> v;
+//    v.reserve(1);
+//    auto before = tracked::take_snapshot();
+//    v.emplace_back(42, "hello");
+//    auto diff = tracked::take_snapshot() - before;
+//    assert(diff.of<tracked::value<Msg>>().copies() == 0);
+//    assert(diff.of<tracked::value<Msg>>().moves() == 0);
+//
+// Every copy construction and copy assignment of B, D and value<T> is counted per type and call
+// site with the bytes it copied, and the sites with the most bytes are printed at exit. A copy
+// construction knows its site from a `std::source_location` default argument, that is the line of
+// the copy, or a line of the standard library if a container copied. Assignment operators can't
+// take one, so they are not inlined and report their caller, named by `symbolize()`. The bytes of
+// a value<T> are sizeof(T) plus size() elements for strings and containers. `copy_report()` prints
+// the table on demand, `set_copy_audit(false)` or TESUJI_TRACKED_COPY_AUDIT as 0 turn it off.
+//
+// Possible output:
+//    copies by type and site, most bytes first:
+//        value<std::string> copied at src/parse.cpp:88 parse(const config&): 12000 copies, 4.1 MiB
+//        value<std::string> copy assigned at merge(table&, const table&)+0x5c (app): 300 copies,
+//        20.1 KiB
+//
+// A container only moves its elements when it grows if their move constructor is noexcept,
+// otherwise `std::move_if_noexcept` copies them. B and D move noexcept unless
+// TESUJI_TRACKED_NOEXCEPT_MOVE is 0, `value<T, NothrowMove, Relocatable>` moves like T unless
+// NothrowMove says otherwise. A copy by the standard library of a type whose move may throw, whose
+// source is destroyed next within the same call into the library, is such a fallback. These are
+// counted per type and by the first caller outside the standard library, where backtrace() is
+// available, and printed at exit.
+// `move_fallback_report()` prints them on demand, `set_move_diagnostics(false)` or
+// TESUJI_TRACKED_MOVE_DIAGNOSTICS as 0 turn it off.
+//
+// Example:
+//    std::vector<tracked::value<std::string, false>> v; // a throwing move
+//    for(int i = 0; i < 5; ++i) {
+//        v.emplace_back("message");
+//    }
+// Possible output at exit:
+//    copies that should have been moves, the move constructor may throw:
+//        value<std::string, throwing move> copied at main+0x8e (app): 7 copies, 224 B
+//
+// A trivially relocatable type can be moved to new memory and the old object forgotten with a
+// memcpy. `is_trivially_relocatable<T>` says which types are, the trivially copyable ones unless
+// specialized, and value<T> is if T is unless Relocatable says otherwise. `relocate()` uses memcpy
+// for them and move and destroy for the others, for tracked values it counts a move construction
+// and a destruction per element either way. B and D are not relocatable, the leak tracker knows
+// them by address.
+//
+// For long runs, `start_event_log()` appends every lifecycle event of B, D and value<T> to a binary
+// file: new, construction, copy, move, assignment, destruction and delete, each a 32 byte
+// `lifecycle_record` with time, thread, type and object address. Records collect in a buffer per
+// thread, which is written when full, at thread exit and by `stop_event_log()`, so logging costs an
+// uncontended lock per event instead of console output. The names of the types follow the records
+// when the log stops. examples/lifecycle_view.cpp rebuilds the lifetimes of the objects from the
+// file, follows copy chains and renders a lifetime chart.
+//
+// Example:
+//    tracked::set_silent();
+//    tracked::start_event_log("lifecycle.bin");
+//    run_service();
+//    tracked::stop_event_log();
+//
+
+struct lifecycle_counts
+{
+    uint64_t default_constructions = 0;
+    uint64_t constructions         = 0; // from other arguments
+    uint64_t copy_constructions    = 0;
+    uint64_t move_constructions    = 0;
+    uint64_t copy_assignments      = 0;
+    uint64_t move_assignments      = 0;
+    uint64_t destructions          = 0;
+    uint64_t allocations           = 0; // calls of the class operator new and new[]
+    uint64_t deallocations         = 0;
+
+    uint64_t live() const {
+        return default_constructions + constructions + copy_constructions + move_constructions
+             - destructions;
+    }
+
+    uint64_t copies() const {
+        return copy_constructions + copy_assignments;
+    }
+
+    uint64_t moves() const {
+        return move_constructions + move_assignments;
+    }
+
+    lifecycle_counts &operator+=(const lifecycle_counts &rhs) {
+        for(size_t i = 0; i < fields.size(); ++i) {
+            this->*fields[i] += rhs.*fields[i];
+        }
+        return *this;
+    }
+
+    friend lifecycle_counts operator-(lifecycle_counts lhs, const lifecycle_counts &rhs) {
+        for(size_t i = 0; i < fields.size(); ++i) {
+            lhs.*fields[i] -= rhs.*fields[i];
+        }
+        return lhs;
+    }
+
+    friend bool operator==(const lifecycle_counts &, const lifecycle_counts &) = default;
+
+    friend std::ostream &operator<<(std::ostream &os, const lifecycle_counts &c) {
+        os << "default: " << c.default_constructions << ", constructed: " << c.constructions
+           << ", copied: " << c.copy_constructions << ", moved: " << c.move_constructions
+           << ", copy assigned: " << c.copy_assignments
+           << ", move assigned: " << c.move_assignments << ", destroyed: " << c.destructions
+           << ", live: " << c.live();
+        if(c.allocations || c.deallocations) {
+            os << ", new: " << c.allocations << ", delete: " << c.deallocations;
+        }
+        return os;
+    }
+
+private:
+    static constexpr std::array<uint64_t lifecycle_counts::*, 9> fields = {
+        &lifecycle_counts::default_constructions, &lifecycle_counts::constructions,
+        &lifecycle_counts::copy_constructions,    &lifecycle_counts::move_constructions,
+        &lifecycle_counts::copy_assignments,      &lifecycle_counts::move_assignments,
+        &lifecycle_counts::destructions,          &lifecycle_counts::allocations,
+        &lifecycle_counts::deallocations};
+};
+
+
+// Counts per type name, taken by `take_snapshot()`. Subtract two snapshots to get the operations
+// in between.
+struct lifecycle_snapshot
+{
+    std::map<std::string, lifecycle_counts, std::less<>> types;
+
+    // The counts of a type, or all zero if it had none.
+    lifecycle_counts of(std::string_view name) const {
+        auto it = types.find(name);
+        return it == types.end() ? lifecycle_counts{} : it->second;
+    }
+
+    // T is B, D or a value<U>.
+    template<typename T> lifecycle_counts of() const {
+        return of(T::tracked_name());
+    }
+
+    lifecycle_counts total() const {
+        lifecycle_counts sum;
+        for(const auto &[name, counts]: types) {
+            sum += counts;
+        }
+        return sum;
+    }
+
+    friend lifecycle_snapshot operator-(lifecycle_snapshot lhs, const lifecycle_snapshot &rhs) {
+        for(auto &[name, counts]: lhs.types) {
+            counts = counts - rhs.of(name);
+        }
+        return lhs;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const lifecycle_snapshot &snapshot) {
+        for(const auto &[name, counts]: snapshot.types) {
+            if(counts != lifecycle_counts{}) {
+                os << name << ": " << counts << "\n";
+            }
+        }
+        return os;
+    }
+};
+
+
+// Formats a byte count with a binary unit, e.g. "1.5 MiB".
+inline std::string bytesToHumanString(uint64_t bytes) {
+    static constexpr const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+
+    double value = double(bytes);
+    size_t unit  = 0;
+    while(value >= 1024 && unit + 1 < std::size(units)) {
+        value /= 1024;
+        ++unit;
+    }
+    return unit == 0 ? std::format("{} B", bytes) : std::format("{:.1f} {}", value, units[unit]);
+}
+
+
+// The order of the fields of lifecycle_counts.
+enum class lifecycle_event : uint8_t
+{
+    default_construction,
+    construction,
+    copy_construction,
+    move_construction,
+    copy_assignment,
+    move_assignment,
+    destruction,
+    allocation,
+    deallocation,
+    end = 0xff // of the records in a log file, the type names follow
+};
+
+
+// One event of an event log, as it is stored in the file. `other` is the source of a copy or move
+// and the size of an allocation.
+struct lifecycle_record
+{
+    int64_t         time; // nanoseconds since the log started
+    uint64_t        object;
+    uint64_t        other;
+    uint32_t        thread;
+    uint16_t        type; // index into the names that follow the records
+    lifecycle_event event;
+    uint8_t         reserved;
+};
+
+static_assert(sizeof(lifecycle_record) == 32);
+
+// A log file starts with these 8 bytes, then the record size as uint32_t and 4 reserved bytes.
+// After the end record, whose `object` is the number of types, every name follows as a uint32_t
+// length and its characters.
+inline constexpr char event_log_magic[8] = {'T', 'S', 'J', 'L', 'I', 'F', 'E', '1'};
+
+
+namespace detail {
+inline void log_event(lifecycle_event event, uint16_t type, const void *object,
+                      uint64_t other) noexcept;
+
+inline std::atomic<bool> eventLogEnabled{false};
+
+
+struct lifecycle_counters
+{
+    std::atomic<uint64_t> default_constructions{0};
+    std::atomic<uint64_t> constructions{0};
+    std::atomic<uint64_t> copy_constructions{0};
+    std::atomic<uint64_t> move_constructions{0};
+    std::atomic<uint64_t> copy_assignments{0};
+    std::atomic<uint64_t> move_assignments{0};
+    std::atomic<uint64_t> destructions{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> deallocations{0};
+    uint16_t              id = 0; // in the lifecycle_registry
+
+    void count(lifecycle_event event, const void *object, uint64_t other = 0) noexcept {
+        (this->*fields[size_t(event)]).fetch_add(1, std::memory_order_relaxed);
+        if(eventLogEnabled.load(std::memory_order_acquire)) {
+            log_event(event, id, object, other);
+        }
+    }
+
+    void count(lifecycle_event event, const void *object, const void *other) noexcept {
+        count(event, object, uint64_t(reinterpret_cast<uintptr_t>(other)));
+    }
+
+    lifecycle_counts load() const {
+        return {default_constructions.load(), constructions.load(), copy_constructions.load(),
+                move_constructions.load(),    copy_assignments.load(), move_assignments.load(),
+                destructions.load(),          allocations.load(),      deallocations.load()};
+    }
+
+    void reset() {
+        for(auto *counter: {&default_constructions, &constructions, &copy_constructions,
+                            &move_constructions, &copy_assignments, &move_assignments,
+                            &destructions, &allocations, &deallocations}) {
+            counter->store(0);
+        }
+    }
+
+private:
+    static constexpr std::array<std::atomic<uint64_t> lifecycle_counters::*, 9> fields = {
+        &lifecycle_counters::default_constructions, &lifecycle_counters::constructions,
+        &lifecycle_counters::copy_constructions,    &lifecycle_counters::move_constructions,
+        &lifecycle_counters::copy_assignments,      &lifecycle_counters::move_assignments,
+        &lifecycle_counters::destructions,          &lifecycle_counters::allocations,
+        &lifecycle_counters::deallocations};
+};
+
+
+struct lifecycle_registry
+{
+    std::mutex                                                 mutex;
+    std::deque<std::pair<std::string, lifecycle_counters>> types; // deque keeps references stable
+
+    static lifecycle_registry &instance() {
+        static lifecycle_registry registry;
+        return registry;
+    }
+};
+
+
+inline lifecycle_counters &counters_for(std::string_view name) {
+    auto           &registry = lifecycle_registry::instance();
+    std::lock_guard lock(registry.mutex);
+    for(auto &[typeName, counters]: registry.types) {
+        if(typeName == name) {
+            return counters;
+        }
+    }
+    auto &counters = registry.types
+                         .emplace_back(std::piecewise_construct, std::forward_as_tuple(name),
+                                       std::forward_as_tuple())
+                         .second;
+    counters.id = uint16_t(registry.types.size() - 1);
+    return counters;
+}
+
+
+template<typename T> std::string type_name() {
+#if defined(__GNUG__)
+    int         status    = 0;
+    char       *demangled = abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status);
+    std::string name      = status == 0 ? demangled : typeid(T).name();
+    std::free(demangled);
+    return name;
+#else
+    return typeid(T).name();
+#endif
+}
+
+
+inline std::atomic<bool>   verbose{!TESUJI_TRACKED_SILENT};
+inline std::atomic<size_t> stackDepth{TESUJI_TRACKED_STACK_DEPTH};
+inline std::atomic<bool>   copyAudit{TESUJI_TRACKED_COPY_AUDIT};
+inline std::atomic<bool>   moveDiagnostics{TESUJI_TRACKED_MOVE_DIAGNOSTICS};
+
+
+// Where copies of one type were made, a source location for copy constructions and the caller for
+// copy assignments and move fallbacks, `file` is nullptr for the latter.
+struct copy_site
+{
+    uint16_t    type;
+    bool        assignment;
+    const char *file;
+    uint32_t    line;
+    const char *function;
+    const void *caller;
+
+    friend bool operator==(const copy_site &, const copy_site &) = default;
+};
+
+
+struct copy_site_hash
+{
+    size_t operator()(const copy_site &site) const noexcept {
+        const size_t where = std::hash<const void *>{}(site.file ? site.file : site.caller);
+        return where ^ (size_t(site.line) << 20) ^ (size_t(site.type) << 4) ^ site.assignment;
+    }
+};
+
+
+// Copies and their bytes by type and site.
+struct site_table
+{
+    struct totals
+    {
+        uint64_t copies = 0;
+        uint64_t bytes  = 0;
+    };
+
+    std::mutex                                            mutex;
+    std::unordered_map<copy_site, totals, copy_site_hash> sites;
+
+    void add(const copy_site &site, uint64_t bytes) {
+        std::lock_guard lock(mutex);
+        totals         &t = sites[site];
+        ++t.copies;
+        t.bytes += bytes;
+    }
+
+    void print(std::ostream &os, std::string_view heading, size_t top) {
+        std::vector<std::pair<copy_site, totals>> ranked;
+        {
+            std::lock_guard lock(mutex);
+            ranked.assign(sites.begin(), sites.end());
+        }
+        print_ranked(os, heading, top, std::move(ranked));
+    }
+
+    static void print_ranked(std::ostream &os, std::string_view heading, size_t top,
+                             std::vector<std::pair<copy_site, totals>> ranked) {
+        if(ranked.empty()) {
+            return;
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.second.bytes > rhs.second.bytes;
+        });
+
+        std::vector<std::string> names;
+        {
+            auto           &registry = lifecycle_registry::instance();
+            std::lock_guard lock(registry.mutex);
+            for(const auto &[name, counters]: registry.types) {
+                names.push_back(name);
+            }
+        }
+
+        os << heading << "\n";
+        for(size_t i = 0; i < std::min(top, ranked.size()); ++i) {
+            const auto &[site, t] = ranked[i];
+            const std::string where =
+                site.file ? std::format("{}:{} {}", site.file, site.line, site.function)
+                          : symbolize(site.caller);
+            os << std::format("    {} {} at {}: {} copies, {}\n",
+                              site.type < names.size() ? names[site.type] : "?",
+                              site.assignment ? "copy assigned" : "copied", where, t.copies,
+                              bytesToHumanString(t.bytes));
+        }
+        os << std::flush;
+    }
+};
+
+
+struct copy_audit : site_table
+{
+    static constexpr const char *heading = "copies by type and site, most bytes first:";
+
+    static copy_audit &instance() {
+        static copy_audit audit;
+        return audit;
+    }
+
+    // Only constructed by the first copy, so a program without copies prints nothing.
+    ~copy_audit() {
+        print(std::cout, heading, 20);
+    }
+};
+
+
+inline void audit_copy(uint16_t type, const std::source_location &site, uint64_t bytes) {
+    if(copyAudit.load(std::memory_order_relaxed)) {
+        copy_audit::instance().add(
+            {type, false, site.file_name(), site.line(), site.function_name(), nullptr}, bytes);
+    }
+}
+
+
+inline void audit_copy_assignment(uint16_t type, const void *caller, uint64_t bytes) {
+    if(copyAudit.load(std::memory_order_relaxed)) {
+        copy_audit::instance().add({type, true, nullptr, 0, nullptr, caller}, bytes);
+    }
+}
+
+
+// Whether the header of a copy belongs to the standard library, libstdc++, libc++ or MSVC's.
+inline bool is_library_site(std::string_view file) {
+    return file.find("/c++/") != std::string_view::npos
+        || file.find("\\MSVC\\") != std::string_view::npos;
+}
+
+
+// Whether a symbolized frame is a function of the standard library or of tesuji. The qualified name
+// is the last word before the parameter list, which skips the return type of a template.
+inline bool is_library_frame(std::string_view symbol) {
+    size_t depth = 0;
+    size_t start = 0;
+    size_t end   = 0;
+    for(; end < symbol.size(); ++end) {
+        const char c = symbol[end];
+        if(depth == 0 && c == '(' && end > start) {
+            break;
+        } else if(c == '<' || c == '(') {
+            ++depth;
+        } else if((c == '>' || c == ')') && depth > 0) {
+            --depth;
+        } else if(depth == 0 && c == ' ') {
+            start = end + 1;
+        }
+    }
+    const std::string_view name = symbol.substr(start, end - start);
+    return name.starts_with("std::") || name.starts_with("__gnu_cxx::")
+        || name.starts_with("tesuji::");
+}
+
+
+// A few return addresses of a call stack, innermost first. Only symbolized when printed.
+struct call_frames
+{
+    static constexpr size_t max_depth = 32;
+
+    std::array<void *, max_depth> addresses{};
+    size_t                        depth = 0;
+
+    // Nothing without backtrace().
+    void capture() noexcept {
+#if TESUJI_HAS_BACKTRACE
+        depth = size_t(std::max(backtrace(addresses.data(), int(max_depth)), 0));
+#endif
+    }
+
+    friend bool operator==(const call_frames &lhs, const call_frames &rhs) {
+        return std::equal(lhs.addresses.begin(), lhs.addresses.begin() + lhs.depth,
+                          rhs.addresses.begin(), rhs.addresses.begin() + rhs.depth);
+    }
+
+    size_t hash() const noexcept {
+        uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a over the addresses
+        for(size_t i = 0; i < depth; ++i) {
+            hash = (hash ^ uint64_t(reinterpret_cast<uintptr_t>(addresses[i]))) * 0x100000001b3ull;
+        }
+        return size_t(hash);
+    }
+
+    // The index of the first frame outside of the standard library and tesuji, `depth` if none.
+    size_t first_outside_library() const {
+        size_t i = 0;
+        while(i < depth && is_library_frame(symbolize(addresses[i]))) {
+            ++i;
+        }
+        return i;
+    }
+
+    // Whether frame `index` of `other` and the frames outside of it are on this stack as well.
+    bool shares_from(const call_frames &other, size_t index) const {
+        for(size_t i = 0; i < depth; ++i) {
+            if(addresses[i] == other.addresses[index]) {
+                const size_t n = std::min(depth - i, other.depth - index);
+                return std::equal(addresses.begin() + i, addresses.begin() + i + n,
+                                  other.addresses.begin() + index);
+            }
+        }
+        return false;
+    }
+};
+
+
+// Copies by the standard library whose source was destroyed next. A fallback of
+// std::move_if_noexcept copies and destroys within one call into the library, like a growing
+// vector does, so the caller outside of the library is on both stacks. A deliberate copy, like
+// `b = a; a.clear();`, has its destruction called from elsewhere. That is told apart when printed,
+// the stacks are symbolized then. Without backtrace() every candidate counts, by source location.
+struct move_fallbacks
+{
+    static constexpr const char *heading =
+        "copies that should have been moves, the move constructor may throw:";
+
+    struct candidate
+    {
+        copy_site   site; // the source location of the copy
+        call_frames copied;
+        call_frames destroyed;
+
+        friend bool operator==(const candidate &, const candidate &) = default;
+    };
+
+    struct candidate_hash
+    {
+        size_t operator()(const candidate &c) const noexcept {
+            return copy_site_hash{}(c.site) ^ (c.copied.hash() * 31) ^ c.destroyed.hash();
+        }
+    };
+
+    std::mutex                                                        mutex;
+    std::unordered_map<candidate, site_table::totals, candidate_hash> candidates;
+
+    static move_fallbacks &instance() {
+        static move_fallbacks fallbacks;
+        return fallbacks;
+    }
+
+    ~move_fallbacks() {
+        print(std::cout, heading, 20);
+    }
+
+    void add(const candidate &c, uint64_t bytes) {
+        std::lock_guard     lock(mutex);
+        site_table::totals &t = candidates[c];
+        ++t.copies;
+        t.bytes += bytes;
+    }
+
+    // The fallbacks by the caller outside of the library.
+    void print(std::ostream &os, std::string_view heading, size_t top) {
+        std::vector<std::pair<candidate, site_table::totals>> all;
+        {
+            std::lock_guard lock(mutex);
+            all.assign(candidates.begin(), candidates.end());
+        }
+
+        std::unordered_map<copy_site, site_table::totals, copy_site_hash> sites;
+        for(const auto &[c, t]: all) {
+            copy_site site = c.site;
+            if(c.copied.depth > 0) {
+                const size_t caller = c.copied.first_outside_library();
+                if(caller < c.copied.depth) {
+                    if(!c.destroyed.shares_from(c.copied, caller)) {
+                        continue; // a deliberate copy
+                    }
+                    site = {site.type, false, nullptr, 0, nullptr, c.copied.addresses[caller]};
+                }
+            }
+            site_table::totals &sum = sites[site];
+            sum.copies += t.copies;
+            sum.bytes += t.bytes;
+        }
+        site_table::print_ranked(os, heading, top, {sites.begin(), sites.end()});
+    }
+};
+
+
+// The copies of one thread by the standard library of types whose move may throw, by the address
+// of their source. When the next destruction is of one of the sources, the copy is a candidate for
+// a move in disguise. Any other destruction ends the sequence. The stacks of the copies are kept
+// once each, the copies of one reallocation share theirs.
+struct pending_copies
+{
+    static constexpr size_t capacity = size_t(1) << 20;
+
+    struct copy
+    {
+        copy_site site;
+        uint64_t  bytes = 0;
+        size_t    stack = 0; // index into `stacks`
+    };
+
+    std::unordered_map<const void *, copy> sources;
+    std::vector<call_frames>               stacks;
+    const void *lastSource = nullptr; // so that the base destructor doesn't end the sequence
+};
+
+inline thread_local std::unique_ptr<pending_copies> pendingCopies;
+
+
+inline void note_library_copy(uint16_t type, const std::source_location &site, const void *source,
+                              uint64_t bytes) {
+    if(!moveDiagnostics.load(std::memory_order_relaxed) || !is_library_site(site.file_name())) {
+        return;
+    }
+    if(!pendingCopies) {
+        pendingCopies = std::make_unique<pending_copies>();
+    }
+    pending_copies &pending = *pendingCopies;
+    if(pending.sources.size() < pending_copies::capacity) {
+        call_frames stack;
+        stack.capture();
+        if(pending.stacks.empty() || !(pending.stacks.back() == stack)) {
+            pending.stacks.push_back(stack);
+        }
+
+        auto &copy = pending.sources[source];
+        copy.site  = {type, false, site.file_name(), site.line(), site.function_name(), nullptr};
+        copy.bytes = bytes;
+        copy.stack = pending.stacks.size() - 1;
+    }
+}
+
+
+inline void source_destroyed(const void *object) {
+    pending_copies *pending = pendingCopies.get();
+    if(!pending || pending->sources.empty()) {
+        return;
+    }
+    auto it = pending->sources.find(object);
+    if(it != pending->sources.end()) {
+        move_fallbacks::candidate c{it->second.site, pending->stacks[it->second.stack], {}};
+        c.destroyed.capture();
+        move_fallbacks::instance().add(c, it->second.bytes);
+        pending->sources.erase(it);
+        pending->lastSource = object;
+    } else if(object != pending->lastSource) {
+        pending->sources.clear();
+        pending->stacks.clear();
+    }
+}
+
+
+// The object and, for strings and containers, their elements, but not what those point to.
+template<typename T> uint64_t copied_bytes(const T &value) {
+    if constexpr(requires {
+                     value.size();
+                     typename T::value_type;
+                 }) {
+        return sizeof(T) + uint64_t(value.size()) * sizeof(typename T::value_type);
+    } else {
+        return sizeof(T);
+    }
+}
+
+
+struct event_buffer;
+
+
+struct event_log
+{
+    std::mutex                            mutex; // the file and the list of buffers
+    std::FILE                            *file = nullptr;
+    std::vector<event_buffer *>           buffers;
+    std::chrono::steady_clock::time_point epoch;
+    std::atomic<uint32_t>                 nextThread{1};
+
+    static event_log &instance() {
+        static event_log log;
+        return log;
+    }
+
+    // Callers hold the mutex.
+    void write(const lifecycle_record *records, size_t count) {
+        if(file && count > 0) {
+            std::fwrite(records, sizeof(lifecycle_record), count, file);
+        }
+    }
+};
+
+
+// The records of one thread. Its thread locks the mutex for every record, stop_event_log() to
+// write the records of all threads.
+struct event_buffer
+{
+    static constexpr size_t capacity = 4096;
+
+    std::mutex                             mutex;
+    std::array<lifecycle_record, capacity> records;
+    size_t                                 count  = 0;
+    uint32_t                               thread = event_log::instance().nextThread++;
+
+    event_buffer() {
+        auto           &log = event_log::instance();
+        std::lock_guard lock(log.mutex);
+        log.buffers.push_back(this);
+    }
+
+    ~event_buffer() {
+        auto           &log = event_log::instance();
+        std::lock_guard lock(log.mutex);
+        std::lock_guard ownLock(mutex);
+        log.write(records.data(), count);
+        std::erase(log.buffers, this);
+    }
+
+    // Callers hold the mutex of the log and of this buffer.
+    void flush() {
+        event_log::instance().write(records.data(), count);
+        count = 0;
+    }
+};
+
+
+inline void log_event(lifecycle_event event, uint16_t type, const void *object,
+                      uint64_t other) noexcept {
+    thread_local std::unique_ptr<event_buffer> buffer = std::make_unique<event_buffer>();
+
+    auto            &log  = event_log::instance();
+    const auto       time = std::chrono::steady_clock::now() - log.epoch;
+    std::unique_lock lock(buffer->mutex);
+    buffer->records[buffer->count++] = {
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(),
+        uint64_t(reinterpret_cast<uintptr_t>(object)), other, buffer->thread, type, event, 0};
+    if(buffer->count < event_buffer::capacity) {
+        return;
+    }
+
+    // lock in the order of stop_event_log()
+    lock.unlock();
+    std::lock_guard logLock(log.mutex);
+    std::lock_guard again(buffer->mutex);
+    buffer->flush();
+}
+} // namespace detail
+
+
+inline lifecycle_snapshot take_snapshot() {
+    auto              &registry = detail::lifecycle_registry::instance();
+    std::lock_guard    lock(registry.mutex);
+    lifecycle_snapshot snapshot;
+    for(const auto &[name, counters]: registry.types) {
+        snapshot.types[name] = counters.load();
+    }
+    return snapshot;
+}
+
+
+// Starts writing the lifecycle events of all tracked types to `path`, false if it can't be
+// opened. A log that is running is stopped first.
+inline bool start_event_log(const std::string &path);
+
+
+// Writes the records of all threads and the type names, then closes the file.
+inline void stop_event_log() {
+    auto           &log = detail::event_log::instance();
+    std::lock_guard lock(log.mutex);
+    detail::eventLogEnabled.store(false);
+    if(!log.file) {
+        return;
+    }
+    for(detail::event_buffer *buffer: log.buffers) {
+        std::lock_guard bufferLock(buffer->mutex);
+        buffer->flush();
+    }
+
+    std::vector<std::string> names;
+    {
+        auto           &registry = detail::lifecycle_registry::instance();
+        std::lock_guard registryLock(registry.mutex);
+        for(const auto &[name, counters]: registry.types) {
+            names.push_back(name);
+        }
+    }
+    const lifecycle_record end{0, names.size(), 0, 0, 0, lifecycle_event::end, 0};
+    log.write(&end, 1);
+    for(const std::string &name: names) {
+        const auto length = uint32_t(name.size());
+        std::fwrite(&length, sizeof(length), 1, log.file);
+        std::fwrite(name.data(), 1, length, log.file);
+    }
+    std::fclose(log.file);
+    log.file = nullptr;
+}
+
+
+inline bool start_event_log(const std::string &path) {
+    stop_event_log();
+
+    auto           &log = detail::event_log::instance();
+    std::lock_guard lock(log.mutex);
+    log.file = std::fopen(path.c_str(), "wb");
+    if(!log.file) {
+        return false;
+    }
+    const uint32_t header[2] = {sizeof(lifecycle_record), 0};
+    std::fwrite(event_log_magic, 1, sizeof(event_log_magic), log.file);
+    std::fwrite(header, sizeof(header), 1, log.file);
+
+    // records that came in after the last log stopped don't belong here
+    for(detail::event_buffer *buffer: log.buffers) {
+        std::lock_guard bufferLock(buffer->mutex);
+        buffer->count = 0;
+    }
+    log.epoch = std::chrono::steady_clock::now();
+    detail::eventLogEnabled.store(true);
+    return true;
+}
+
+
+// Counting copies per site takes a lock per copy, turn it off for hot loops.
+inline void set_copy_audit(bool on = true) {
+    detail::copyAudit.store(on, std::memory_order_relaxed);
+}
+
+
+// Prints the `top` sites of copies by bytes copied, as at exit.
+inline void copy_report(std::ostream &os = std::cout, size_t top = 20) {
+    auto &audit = detail::copy_audit::instance();
+    audit.print(os, audit.heading, top);
+}
+
+
+// Noting which copies the standard library made of types whose move may throw costs a lookup per
+// destruction while there are any.
+inline void set_move_diagnostics(bool on = true) {
+    detail::moveDiagnostics.store(on, std::memory_order_relaxed);
+    if(!on && detail::pendingCopies) {
+        detail::pendingCopies->sources.clear();
+    }
+}
+
+
+// Prints the `top` sites of copies that should have been moves by bytes copied, as at exit.
+inline void move_fallback_report(std::ostream &os = std::cout, size_t top = 20) {
+    auto &fallbacks = detail::move_fallbacks::instance();
+    fallbacks.print(os, fallbacks.heading, top);
+}
+
+
+// How many return addresses are kept for every allocation of B and D, for the leak report. 0 turns
+// capturing off, at most 64.
+inline void set_stack_depth(size_t depth) {
+    detail::stackDepth.store(depth, std::memory_order_relaxed);
+}
+
+
+// In silent mode B and D only count, they print nothing but errors and the leaks at exit.
+inline void set_silent(bool silent = true) {
+    detail::verbose.store(!silent, std::memory_order_relaxed);
+}
+
+
+struct silent_scope
+{
+    bool wasVerbose = detail::verbose.exchange(false, std::memory_order_relaxed);
+
+    silent_scope() = default;
+    silent_scope(const silent_scope &) = delete;
+
+    ~silent_scope() {
+        detail::verbose.store(wasVerbose, std::memory_order_relaxed);
+    }
+};
+
+
+namespace detail {
+inline std::atomic<std::pmr::memory_resource *> backing{nullptr};
+
+
+// malloc is called directly, without the virtual call.
+inline void *backing_allocate(std::pmr::memory_resource *resource, size_t size) {
+    if(resource != malloc_resource()) {
+        return resource->allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    }
+    if(void *p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+
+inline void backing_deallocate(std::pmr::memory_resource *resource, void *p, size_t size) {
+    if(resource != malloc_resource()) {
+        return resource->deallocate(p, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    }
+    std::free(p);
+}
+} // namespace detail
+
+
+// The memory resource that operator new and delete of B and D use, `malloc_resource()` unless set.
+inline std::pmr::memory_resource *backing_resource() {
+    std::pmr::memory_resource *resource = detail::backing.load(std::memory_order_acquire);
+    return resource ? resource : malloc_resource();
+}
+
+
+// Every object is freed by the resource that allocated it, so the resource can change any time but
+// must outlive its objects. All threads share it, an arena is only safe for a single thread.
+// nullptr restores malloc.
+inline void set_backing_resource(std::pmr::memory_resource *resource) {
+    detail::backing.store(resource, std::memory_order_release);
+}
+
+
+struct backing_scope
+{
+    std::pmr::memory_resource *previous = detail::backing.load(std::memory_order_acquire);
+
+    explicit backing_scope(std::pmr::memory_resource *resource) {
+        set_backing_resource(resource);
+    }
+
+    backing_scope(const backing_scope &) = delete;
+
+    ~backing_scope() {
+        set_backing_resource(previous);
+    }
+};
+
 
 namespace detail {
+struct allocation
+{
+    enum state_t : uint8_t { empty, live, deleted };
+
+    static constexpr size_t unconstructed = size_t(-1);
+
+    void       *address   = nullptr;
+    const char *classname = "";
+    size_t      counter   = unconstructed;
+    state_t     state     = empty;
+    uint32_t    stack     = 0; // id in the stack_table, 0 for none
+    size_t      size      = 0;
+
+    std::pmr::memory_resource *resource = nullptr; // that frees it
+
+    friend std::ostream &operator<<(std::ostream &os, const allocation &alloc) {
+        os << alloc.classname << alloc.counter << "(0x" << alloc.address << ")["
+           << (alloc.state == deleted ? "d" : "a") << "]";
+        return os;
+    }
+};
+
+
+// Open addressing hash table of allocations keyed by address, with linear probing, so that new,
+// delete and construction cost O(1) however many objects are alive. A delete leaves a tombstone
+// that remembers the object, so a second delete of the address is reported as a double delete
+// until the address is allocated again or the table drops its tombstones when it grows.
+// Entry needs the members `address` and `state` of `allocation`.
+template<typename Entry = allocation, typename Alloc = std::allocator<Entry>> struct alloc_table
+{
+    // Returns a default constructed live entry for `address`.
+    Entry &insert(void *address) {
+        if((m_used + 1) * 4 > m_slots.size() * 3) {
+            rehash();
+        }
+
+        Entry &slot = insert_slot(address);
+        if(slot.state == allocation::empty) {
+            ++m_used;
+        }
+        slot         = Entry{};
+        slot.address = address;
+        slot.state   = allocation::live;
+        ++m_live;
+        return slot;
+    }
+
+    // The live entry or the tombstone at `address`.
+    Entry *find(void *address) {
+        if(m_slots.empty()) {
+            return nullptr;
+        }
+        const size_t mask = m_slots.size() - 1;
+        for(size_t i = home(address);; i = (i + 1) & mask) {
+            if(m_slots[i].state == allocation::empty) {
+                return nullptr;
+            }
+            if(m_slots[i].address == address) {
+                return &m_slots[i];
+            }
+        }
+    }
+
+    void erase(Entry &entry) {
+        entry.state = allocation::deleted;
+        --m_live;
+    }
+
+    size_t live() const {
+        return m_live;
+    }
+
+    // The memory of the table itself.
+    size_t bytes() const {
+        return m_slots.capacity() * sizeof(Entry);
+    }
+
+    void for_each_live(auto &&func) const {
+        for(const Entry &entry: m_slots) {
+            if(entry.state == allocation::live) {
+                func(entry);
+            }
+        }
+    }
+
+private:
+    size_t home(void *address) const {
+        // Fibonacci hashing, the low bits of an address are mostly alignment
+        const auto hash = uint64_t(reinterpret_cast<uintptr_t>(address)) * 0x9E3779B97F4A7C15ull;
+        return size_t(hash >> (64 - std::countr_zero(m_slots.size())));
+    }
+
+    // The slot holding `address`, else the first tombstone or empty slot on its probe sequence.
+    Entry &insert_slot(void *address) {
+        const size_t mask      = m_slots.size() - 1;
+        Entry       *tombstone = nullptr;
+        for(size_t i = home(address);; i = (i + 1) & mask) {
+            Entry &slot = m_slots[i];
+            if(slot.state == allocation::empty) {
+                return tombstone ? *tombstone : slot;
+            }
+            if(slot.address == address) {
+                return slot;
+            }
+            if(slot.state == allocation::deleted && !tombstone) {
+                tombstone = &slot;
+            }
+        }
+    }
+
+    // Grows the table to twice the live allocations and drops the tombstones.
+    void rehash() {
+        const size_t capacity = std::bit_ceil(std::max<size_t>(16, (m_live + 1) * 2));
+        auto         old = std::exchange(m_slots, std::vector<Entry, Alloc>(capacity, Alloc{}));
+        m_used           = m_live;
+        for(const Entry &entry: old) {
+            if(entry.state == allocation::live) {
+                insert_slot(entry.address) = entry;
+            }
+        }
+    }
+
+    std::vector<Entry, Alloc> m_slots;
+    size_t                    m_used = 0; // live and deleted slots
+    size_t                    m_live = 0;
+};
+
+
+// The return addresses of the allocating call stacks, every distinct stack stored once. Stacks are
+// only symbolized when a leak report prints them.
+struct stack_table
+{
+    static constexpr size_t max_depth = 64;
+
+    // The id of the calling stack, 0 if stacks aren't captured. The stack starts at the frame that
+    // returns to `caller`, the return address of the allocating operator new. Frames above it are
+    // skipped however the compiler inlined them.
+    [[gnu::noinline]] uint32_t capture(void *caller) {
+#if TESUJI_HAS_BACKTRACE
+        const size_t depth = std::min(stackDepth.load(std::memory_order_relaxed), max_depth);
+        if(depth == 0) {
+            return 0;
+        }
+
+        // this function, alloc_tracker::new_ and the class operator new, plus some slack
+        constexpr int max_skip = 8;
+        void         *frames[max_depth + max_skip];
+        const int     n = backtrace(frames, int(depth) + max_skip);
+
+        int skip = 0;
+        while(skip < n && frames[skip] != caller) {
+            ++skip;
+        }
+        if(skip == n) {
+            skip = 3; // not found, assume every frame above is a call of its own
+        }
+        if(n <= skip) {
+            return 0;
+        }
+
+        const int           end = std::min(n, skip + int(depth));
+        std::vector<void *> stack(frames + skip, frames + end);
+        uint64_t            hash = 0xcbf29ce484222325ull; // FNV-1a over the addresses
+        for(void *frame: stack) {
+            hash = (hash ^ uint64_t(reinterpret_cast<uintptr_t>(frame))) * 0x100000001b3ull;
+        }
+
+        std::lock_guard lock(m_mutex);
+        auto           &ids = m_index[hash];
+        for(uint32_t id: ids) {
+            if(m_stacks[id - 1] == stack) {
+                return id;
+            }
+        }
+        m_stacks.push_back(std::move(stack));
+        ids.push_back(uint32_t(m_stacks.size()));
+        return ids.back();
+#else
+        return 0;
+#endif
+    }
+
+    std::vector<void *> frames(uint32_t id) {
+        std::lock_guard lock(m_mutex);
+        return id == 0 || id > m_stacks.size() ? std::vector<void *>{} : m_stacks[id - 1];
+    }
+
+private:
+    std::mutex                                             m_mutex;
+    std::vector<std::vector<void *>>                       m_stacks;
+    std::unordered_map<uint64_t, std::vector<uint32_t>>    m_index; // stack hash to ids
+};
+
+
+// Every thread records its allocations in a shard of its own, so threads don't contend on one
+// table. A shard has a mutex anyway, because an object may be deleted by another thread than the
+// one that created it. Such a delete misses in the deleting thread's shard and then looks through
+// all shards, so it costs O(threads). The shard of a finished thread is handed to the next new
+// thread, its allocations stay tracked.
 struct alloc_tracker
 {
     alloc_tracker()                      = default;
     alloc_tracker(const alloc_tracker &) = delete;
 
     ~alloc_tracker() {
-        for(const allocation &alloc: m_allocs) {
-            if(!alloc.deleted) {
-                static const auto execOnlyOnce = []() {
-                    std::cout << "leaked objects: ";
-                    return true;
-                }();
+        std::vector<allocation> leaked;
+        for(shard &s: m_shards) {
+            s.table.for_each_live([&](const allocation &alloc) { leaked.push_back(alloc); });
+        }
+        if(leaked.empty()) {
+            return;
+        }
 
-                std::cout << alloc.classname << alloc.counter << "(0x" << alloc.address << ") "
-                          << std::flush;
-            }
+        std::sort(leaked.begin(), leaked.end(), [](const allocation &lhs, const allocation &rhs) {
+            return lhs.counter < rhs.counter;
+        });
+        std::cout << "leaked objects: ";
+        for(const allocation &alloc: leaked) {
+            std::cout << alloc.classname << alloc.counter << "(0x" << alloc.address << ") "
+                      << std::flush;
         }
+        print_leak_stacks(leaked);
     }
 
-    void new_(void *address) {
-        m_allocs.emplace_back(allocation{address, "", -1, false});
+    [[gnu::noinline]] void
+    new_(void *address, size_t size, std::pmr::memory_resource *resource, void *caller) {
+        const uint32_t  stack = m_stacks.capture(caller);
+        shard          &own   = local();
+        std::lock_guard lock(own.mutex);
+        allocation     &alloc = own.table.insert(address);
+        alloc.stack           = stack;
+        alloc.size            = size;
+        alloc.resource        = resource;
     }
 
-    bool delete_(void *address, const std::string &classname) {
-        auto allocIt =
-            std::find_if(m_allocs.rbegin(), m_allocs.rend(), [&](const allocation &alloc) {
-                return alloc.address == address /*&& alloc.classname == classname*/;
-            });
+    struct freed
+    {
+        std::pmr::memory_resource *resource = nullptr; // to free with, nullptr to not free
+        size_t                     size     = 0;
+    };
 
-        if(allocIt == m_allocs.rend()) {
-            std::cout << "delete of unkown object " << classname << "(0x" << address << ") "
-                      << std::flush;
+    freed delete_(void *address, const char *classname) {
+        const char *deletedClassname = nullptr;
+        freed       result;
+        auto        tryShard = [&](shard &s) {
+            std::lock_guard lock(s.mutex);
+            allocation     *alloc = s.table.find(address);
+            if(alloc && alloc->state == allocation::live) {
+                result = {alloc->resource, alloc->size};
+                s.table.erase(*alloc);
+                return true;
+            }
+            if(alloc && !deletedClassname) {
+                deletedClassname = alloc->classname;
+            }
             return false;
-        } else {
-            if(allocIt->deleted) {
-                std::cout << "double delete of " << allocIt->classname << "(0x" << address << ") "
-                          << std::flush;
-                return false;
-            } else {
-                allocIt->deleted = true;
-                return false;
+        };
+
+        shard &own = local();
+        if(tryShard(own)) {
+            return result;
+        }
+        {
+            // the address may be live in another shard even if this one has a tombstone for it
+            std::lock_guard lock(m_shardsMutex);
+            for(shard &s: m_shards) {
+                if(&s != &own && tryShard(s)) {
+                    return result;
+                }
             }
         }
+
+        if(deletedClassname) {
+            std::cout << "double delete of " << deletedClassname << "(0x" << address << ") "
+                      << std::flush;
+        } else {
+            std::cout << "delete of unkown object " << classname << "(0x" << address << ") "
+                      << std::flush;
+        }
+        return {};
+    }
+
+    // Objects are constructed by the thread that allocated them, so only its shard is searched.
+    void construct_(void *address, const char *classname, size_t counter) {
+        shard          &own = local();
+        std::lock_guard lock(own.mutex);
+        allocation     *alloc = own.table.find(address);
+
+        if(alloc && alloc->state == allocation::live) {
+            assert(alloc->counter == allocation::unconstructed || alloc->counter == counter);
+
+            alloc->classname = classname;
+            alloc->counter   = counter;
+        }
+    }
+
+    size_t live() {
+        size_t          n = 0;
+        std::lock_guard lock(m_shardsMutex);
+        for(shard &s: m_shards) {
+            std::lock_guard shardLock(s.mutex);
+            n += s.table.live();
+        }
+        return n;
+    }
+
+    // The memory of the allocation tables, for tools that measure the heap around them.
+    size_t table_bytes() {
+        size_t          n = 0;
+        std::lock_guard lock(m_shardsMutex);
+        for(shard &s: m_shards) {
+            std::lock_guard shardLock(s.mutex);
+            n += s.table.bytes();
+        }
+        return n;
     }
 
-    void construct_(void *address, const std::string &classname, int counter) {
-        auto allocIt =
-            std::find_if(m_allocs.begin(), m_allocs.end(), [address](const allocation &alloc) {
-                return alloc.address == address;
-            });
+private:
+    // Groups the leaks by their allocating stack, the most leaked bytes first.
+    void print_leak_stacks(const std::vector<allocation> &leaked) {
+        struct group
+        {
+            uint32_t                        stack;
+            size_t                          bytes = 0;
+            std::vector<const allocation *> leaks;
+        };
 
-        if(allocIt != m_allocs.end()) {
-            assert(allocIt->counter == -1 || allocIt->counter == counter);
+        std::map<uint32_t, group> groups;
+        for(const allocation &alloc: leaked) {
+            auto &g  = groups.try_emplace(alloc.stack, group{alloc.stack, 0, {}}).first->second;
+            g.bytes += alloc.size;
+            g.leaks.push_back(&alloc);
+        }
+        if(groups.size() == 1 && groups.begin()->first == 0) {
+            std::cout << "\n";
+            return; // no stacks captured
+        }
+
+        std::vector<const group *> sorted;
+        for(const auto &[stack, g]: groups) {
+            sorted.push_back(&g);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const group *lhs, const group *rhs) {
+            return lhs->bytes > rhs->bytes;
+        });
 
-            allocIt->classname = classname;
-            allocIt->counter   = counter;
+        std::cout << "\nleaks by allocation stack:\n";
+        for(const group *g: sorted) {
+            const size_t count = g->leaks.size();
+            std::cout << "    " << count << (count == 1 ? " leak, " : " leaks, ") << g->bytes
+                      << " bytes:";
+            for(const allocation *alloc: g->leaks) {
+                std::cout << " " << alloc->classname << alloc->counter;
+            }
+            std::cout << "\n";
+            for(void *frame: m_stacks.frames(g->stack)) {
+                std::cout << "        " << symbolize(frame) << "\n";
+            }
         }
+        std::cout << std::flush;
     }
 
-    struct allocation
+    struct shard
+    {
+        std::mutex    mutex;
+        alloc_table<> table;
+    };
+
+    // Returns the shard to the free list when its thread ends.
+    struct shard_handle
     {
-        void       *address;
-        std::string classname;
-        int         counter;
-        bool        deleted;
+        alloc_tracker *tracker;
+        shard         *s;
+
+        shard_handle(alloc_tracker *tracker)
+            : tracker(tracker) {
+            std::lock_guard lock(tracker->m_shardsMutex);
+            if(tracker->m_freeShards.empty()) {
+                s = &tracker->m_shards.emplace_back();
+            } else {
+                s = tracker->m_freeShards.back();
+                tracker->m_freeShards.pop_back();
+            }
+        }
 
-        friend std::ostream &operator<<(std::ostream &os, const allocation &alloc) {
-            os << alloc.classname << alloc.counter << "(0x" << alloc.address << ")["
-               << (alloc.deleted ? "d" : "a") << "]";
-            return os;
+        ~shard_handle() {
+            std::lock_guard lock(tracker->m_shardsMutex);
+            tracker->m_freeShards.push_back(s);
         }
     };
 
-    std::vector<allocation> m_allocs;
+    shard &local() {
+        thread_local shard_handle handle(this);
+        return *handle.s;
+    }
+
+    std::mutex           m_shardsMutex;
+    std::deque<shard>    m_shards; // deque keeps references stable
+    std::vector<shard *> m_freeShards;
+    stack_table          m_stacks;
 };
 
 struct tracked_base
 {
-    static size_t        currentCounter;
-    static alloc_tracker allocs;
+    static inline std::atomic<size_t> currentCounter = 0;
+    static inline alloc_tracker       allocs;
 
 protected:
     tracked_base()
-        : m_counter(currentCounter++) {}
+        : m_counter(currentCounter.fetch_add(1, std::memory_order_relaxed)) {}
 
 protected:
     size_t m_counter;
 };
 
-size_t        tracked_base::currentCounter = 0;
-alloc_tracker tracked_base::allocs;
-
 } // namespace detail
 
 
@@ -138,67 +1521,109 @@ private:
     static constexpr const char *classname = #C;                                                   \
     friend class alloc_tracker;                                                                    \
                                                                                                    \
+    static detail::lifecycle_counters &counters() {                                                \
+        static detail::lifecycle_counters &c = detail::counters_for(classname);                    \
+        return c;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
 public:                                                                                            \
+    static std::string_view tracked_name() {                                                       \
+        return classname;                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static lifecycle_counts counts() {                                                             \
+        return counters().load();                                                                  \
+    }                                                                                              \
+                                                                                                   \
     /*construction*/                                                                               \
     C() {                                                                                          \
         allocs.construct_(this, classname, m_counter);                                             \
-        std::cout << classname << m_counter << "() " << std::flush;                                \
+        counters().count(lifecycle_event::default_construction, this);                             \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << classname << m_counter << "() " << std::flush;                            \
     }                                                                                              \
                                                                                                    \
-    C(const C &rhs) {                                                                              \
-        std::cout << classname << m_counter << "(" << rhs.classname << rhs.m_counter << "&) "      \
-                  << std::flush;                                                                   \
+    C(const C &rhs, std::source_location site = std::source_location::current()) {                 \
+        counters().count(lifecycle_event::copy_construction, this, &rhs);                          \
+        detail::audit_copy(counters().id, site, sizeof(C));                                        \
+        if constexpr(!std::is_nothrow_move_constructible_v<C>)                                     \
+            detail::note_library_copy(counters().id, site, &rhs, sizeof(C));                       \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << classname << m_counter << "(" << rhs.classname << rhs.m_counter << "&) "  \
+                      << std::flush;                                                               \
     }                                                                                              \
                                                                                                    \
-    C(C &&rhs) {                                                                                   \
-        std::cout << classname << m_counter << "(" << rhs.classname << rhs.m_counter << "&&) "     \
-                  << std::flush;                                                                   \
+    C(C &&rhs) noexcept(TESUJI_TRACKED_NOEXCEPT_MOVE) {                                            \
+        counters().count(lifecycle_event::move_construction, this, &rhs);                          \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << classname << m_counter << "(" << rhs.classname << rhs.m_counter << "&&) " \
+                      << std::flush;                                                               \
     }                                                                                              \
                                                                                                    \
-    void *operator new(size_t count) {                                                             \
-        void *p = malloc(count);                                                                   \
-        allocs.new_(p);                                                                            \
-        std::cout << "new(" << classname << ") " << std::flush;                                    \
+    [[gnu::noinline]] void *operator new(size_t count) {                                           \
+        std::pmr::memory_resource *resource = backing_resource();                                  \
+        void                      *p        = detail::backing_allocate(resource, count);           \
+        allocs.new_(p, count, resource, TESUJI_RETURN_ADDRESS());                                  \
+        counters().count(lifecycle_event::allocation, p, count);                                   \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << "new(" << classname << ") " << std::flush;                                \
         return p;                                                                                  \
     }                                                                                              \
                                                                                                    \
-    void *operator new[](size_t count) {                                                           \
-        size_t numberOfObjects = count / sizeof(C); /*truncation is correct here*/                 \
-        void  *p               = malloc(count);                                                    \
-        allocs.new_(p);                                                                            \
-        std::cout << "new[" << numberOfObjects << "](" << classname << ") " << std::flush;         \
+    [[gnu::noinline]] void *operator new[](size_t count) {                                         \
+        size_t                     numberOfObjects = count / sizeof(C); /*truncation is correct*/  \
+        std::pmr::memory_resource *resource        = backing_resource();                           \
+        void                      *p               = detail::backing_allocate(resource, count);    \
+        allocs.new_(p, count, resource, TESUJI_RETURN_ADDRESS());                                  \
+        counters().count(lifecycle_event::allocation, p, count);                                   \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << "new[" << numberOfObjects << "](" << classname << ") " << std::flush;     \
         return p;                                                                                  \
     }                                                                                              \
                                                                                                    \
     /*destruction*/                                                                                \
     virtual ~C() {                                                                                 \
-        std::cout << "~" << classname << m_counter << "() " << std::flush;                         \
+        counters().count(lifecycle_event::destruction, this);                                      \
+        detail::source_destroyed(this);                                                            \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << "~" << classname << m_counter << "() " << std::flush;                     \
     }                                                                                              \
                                                                                                    \
     void operator delete(void *p) {                                                                \
-        const bool toDelete = allocs.delete_(p, classname);                                        \
-        std::cout << "delete(" << classname << ") " << std::flush;                                 \
-        if(toDelete)                                                                               \
-            free(p);                                                                               \
+        const auto freed = allocs.delete_(p, classname);                                           \
+        counters().count(lifecycle_event::deallocation, p);                                        \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << "delete(" << classname << ") " << std::flush;                             \
+        if(freed.resource)                                                                         \
+            detail::backing_deallocate(freed.resource, p, freed.size);                             \
     }                                                                                              \
                                                                                                    \
     void operator delete[](void *p) {                                                              \
-        const bool toDelete = allocs.delete_(p, classname);                                        \
-        std::cout << "delete[](" << classname << ") " << std::flush;                               \
-        if(toDelete)                                                                               \
-            free(p);                                                                               \
+        const auto freed = allocs.delete_(p, classname);                                           \
+        counters().count(lifecycle_event::deallocation, p);                                        \
+        if(detail::verbose.load(std::memory_order_relaxed))                                        \
+            std::cout << "delete[](" << classname << ") " << std::flush;                           \
+        if(freed.resource)                                                                         \
+            detail::backing_deallocate(freed.resource, p, freed.size);                             \
     }                                                                                              \
                                                                                                    \
     /*movement*/                                                                                   \
-    const C &operator=(const C &rhs) {                                                             \
-        std::cout << rhs.classname << rhs.m_counter << "=";                                        \
-        std::cout << classname << m_counter << "(&) " << std::flush;                               \
+    [[gnu::noinline]] const C &operator=(const C &rhs) {                                           \
+        counters().count(lifecycle_event::copy_assignment, this, &rhs);                            \
+        detail::audit_copy_assignment(counters().id, TESUJI_RETURN_ADDRESS(), sizeof(C));          \
+        if(detail::verbose.load(std::memory_order_relaxed)) {                                      \
+            std::cout << rhs.classname << rhs.m_counter << "=";                                    \
+            std::cout << classname << m_counter << "(&) " << std::flush;                           \
+        }                                                                                          \
         return *this;                                                                              \
     }                                                                                              \
                                                                                                    \
-    C &operator=(C &&rhs) {                                                                        \
-        std::cout << rhs.classname << rhs.m_counter << "=";                                        \
-        std::cout << classname << m_counter << "(&&) " << std::flush;                              \
+    C &operator=(C &&rhs) noexcept(TESUJI_TRACKED_NOEXCEPT_MOVE) {                                 \
+        counters().count(lifecycle_event::move_assignment, this, &rhs);                            \
+        if(detail::verbose.load(std::memory_order_relaxed)) {                                      \
+            std::cout << rhs.classname << rhs.m_counter << "=";                                    \
+            std::cout << classname << m_counter << "(&&) " << std::flush;                          \
+        }                                                                                          \
         return *this;                                                                              \
     }
 
@@ -216,4 +1641,204 @@ struct D : B
 #undef TESUJI_TRACKED_MEMBER_FUNCS
 
 
+// Whether a T can be moved to new memory with memcpy, forgetting the old one. Specialize it for
+// types that are but aren't trivially copyable, e.g. most that own their memory through a pointer.
+template<typename T> struct is_trivially_relocatable : std::is_trivially_copyable<T>
+{};
+
+template<typename T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+
+template<typename T, bool NothrowMove = std::is_nothrow_move_constructible_v<T>,
+         bool Relocatable = is_trivially_relocatable_v<T>>
+struct value
+{
+    using value_type = T;
+
+    value() noexcept(std::is_nothrow_default_constructible_v<T>)
+        : m_value() {
+        counters().count(lifecycle_event::default_construction, this);
+    }
+
+    template<typename... Args>
+        requires std::is_constructible_v<T, Args &&...>
+                 && (sizeof...(Args) != 1
+                     || !(std::is_same_v<std::remove_cvref_t<Args>, value> || ...))
+    value(Args &&...args) noexcept(std::is_nothrow_constructible_v<T, Args &&...>)
+        : m_value(std::forward<Args>(args)...) {
+        counters().count(lifecycle_event::construction, this);
+    }
+
+    value(const value &rhs, std::source_location site = std::source_location::current()) noexcept(
+        std::is_nothrow_copy_constructible_v<T>)
+        : m_value(rhs.m_value) {
+        counters().count(lifecycle_event::copy_construction, this, &rhs);
+        detail::audit_copy(counters().id, site, detail::copied_bytes(m_value));
+        if constexpr(!NothrowMove) {
+            detail::note_library_copy(counters().id, site, &rhs, detail::copied_bytes(m_value));
+        }
+    }
+
+    value(value &&rhs) noexcept(NothrowMove)
+        : m_value(std::move(rhs.m_value)) {
+        counters().count(lifecycle_event::move_construction, this, &rhs);
+    }
+
+    [[gnu::noinline]] value &operator=(const value &rhs) noexcept(
+        std::is_nothrow_copy_assignable_v<T>) {
+        m_value = rhs.m_value;
+        counters().count(lifecycle_event::copy_assignment, this, &rhs);
+        detail::audit_copy_assignment(counters().id, TESUJI_RETURN_ADDRESS(),
+                                      detail::copied_bytes(m_value));
+        return *this;
+    }
+
+    value &operator=(value &&rhs) noexcept(NothrowMove) {
+        m_value = std::move(rhs.m_value);
+        counters().count(lifecycle_event::move_assignment, this, &rhs);
+        return *this;
+    }
+
+    ~value() {
+        counters().count(lifecycle_event::destruction, this);
+        detail::source_destroyed(this);
+    }
+
+    T &get() noexcept {
+        return m_value;
+    }
+
+    const T &get() const noexcept {
+        return m_value;
+    }
+
+    operator T &() noexcept {
+        return m_value;
+    }
+
+    operator const T &() const noexcept {
+        return m_value;
+    }
+
+    T *operator->() noexcept {
+        return &m_value;
+    }
+
+    const T *operator->() const noexcept {
+        return &m_value;
+    }
+
+    T &operator*() noexcept {
+        return m_value;
+    }
+
+    const T &operator*() const noexcept {
+        return m_value;
+    }
+
+    static lifecycle_counts counts() {
+        return counters().load();
+    }
+
+    static void reset_counts() {
+        counters().reset();
+    }
+
+    // Values with other moves than T count separately, e.g. "value<std::string, throwing move>".
+    static const std::string &tracked_name() {
+        static const std::string name = [] {
+            std::string result = "value<" + detail::type_name<T>();
+            if(NothrowMove != std::is_nothrow_move_constructible_v<T>) {
+                result += NothrowMove ? ", noexcept move" : ", throwing move";
+            }
+            if(Relocatable != is_trivially_relocatable_v<T>) {
+                result += Relocatable ? ", relocatable" : ", not relocatable";
+            }
+            return result + ">";
+        }();
+        return name;
+    }
+
+    // Called by relocate() for values it copied with memcpy.
+    static void count_relocation(const value *from, const value *to, size_t n) noexcept {
+        for(size_t i = 0; i < n; ++i) {
+            counters().count(lifecycle_event::move_construction, to + i, from + i);
+            counters().count(lifecycle_event::destruction, from + i);
+        }
+    }
+
+    friend bool operator==(const value &lhs, const value &rhs)
+        requires std::equality_comparable<T>
+    {
+        return lhs.m_value == rhs.m_value;
+    }
+
+    friend auto operator<=>(const value &lhs, const value &rhs)
+        requires std::three_way_comparable<T>
+    {
+        return lhs.m_value <=> rhs.m_value;
+    }
+
+    // for types that only have operator<
+    friend bool operator<(const value &lhs, const value &rhs)
+        requires(!std::three_way_comparable<T>) && requires(const T &t) { t < t; }
+    {
+        return lhs.m_value < rhs.m_value;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const value &v)
+        requires requires(std::ostream &o, const T &t) { o << t; }
+    {
+        return os << v.m_value;
+    }
+
+private:
+    static detail::lifecycle_counters &counters() {
+        static detail::lifecycle_counters &c = detail::counters_for(tracked_name());
+        return c;
+    }
+
+    T m_value;
+};
+
+
+template<typename T, bool NothrowMove, bool Relocatable>
+struct is_trivially_relocatable<value<T, NothrowMove, Relocatable>>
+    : std::bool_constant<Relocatable>
+{};
+
+
+// Moves [first, last) to the uninitialized memory at dest and ends the lifetime of the originals.
+// The ranges must not overlap. Returns the end of the relocated range.
+template<typename T> T *relocate(T *first, T *last, T *dest) {
+    const size_t n = size_t(last - first);
+    if constexpr(is_trivially_relocatable_v<T>) {
+        if(n > 0) {
+            std::memcpy(static_cast<void *>(dest), static_cast<const void *>(first), n * sizeof(T));
+        }
+        if constexpr(requires { T::count_relocation(first, dest, n); }) {
+            T::count_relocation(first, dest, n);
+        }
+    } else {
+        for(size_t i = 0; i < n; ++i) {
+            std::construct_at(dest + i, std::move(first[i]));
+            std::destroy_at(first + i);
+        }
+    }
+    return dest + n;
+}
+
+
 } // namespace tesuji::tracked
+
+
+template<typename T, bool NothrowMove, bool Relocatable>
+struct std::hash<tesuji::tracked::value<T, NothrowMove, Relocatable>>
+{
+    size_t operator()(const tesuji::tracked::value<T, NothrowMove, Relocatable> &v) const {
+        return std::hash<T>{}(v.get());
+    }
+};
+
+#undef TESUJI_HAS_BACKTRACE
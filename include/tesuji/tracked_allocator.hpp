@@ -0,0 +1,267 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "tracked_heap.hpp"
+
+#include <memory>
+#include <typeinfo>
+
+
+namespace tesuji::tracked {
+
+// Provides an allocator for the standard containers that counts what one container, or all
+// containers with the same tag, allocate.
+//      template<typename T, typename Upstream = std::allocator<T>> struct counting_allocator;
+//      allocation_counts allocation_counts_for(std::string_view tag);
+//      void allocator_report(std::ostream &os = std::cout);
+//
+// The counts are allocations, bytes, live and peak bytes, and reallocations: a block freed right
+// after a larger block of the same type was allocated, which is how a vector grows and how an
+// unordered container rehashes its buckets. The bytes of the freed blocks are what the growth moved
+// or copied. Many reallocations with few allocations in between say that `reserve()` pays off.
+//
+// A default constructed allocator counts for its container alone, `get_allocator().counts()`
+// reads them. A copy of a container starts with counts of its own. Moves and swaps take the counts
+// with the memory, and a moved-from container keeps counting into them as well. Allocators
+// constructed with a tag share the counts of all containers with that tag, also across threads.
+// Memory comes from Upstream, e.g. a `resource_allocator` of arena.hpp.
+//
+// Example:
+//      std::vector<int, tracked::counting_allocator<int>> v;
+//      for(int i = 0; i < 1000; ++i) {
+//          v.push_back(i);
+//      }
+//      std::cout << v.get_allocator().counts() << "\n";
+//
+//      using alloc = tracked::counting_allocator<std::pair<const int, int>>;
+//      std::unordered_map<int, int, std::hash<int>, std::equal_to<>, alloc> m(alloc("index"));
+//      for(int i = 0; i < 1000; ++i) {
+//          m[i] = i;
+//      }
+//      tracked::allocator_report();
+// Possible output:
+//      allocations: 11, 8.0 KiB, reallocations: 10 moving 4.0 KiB, peak: 6.0 KiB, live: 4.0 KiB
+//      allocators by bytes:
+//          index: allocations: 1007, 32.3 KiB, reallocations: 6 moving 8.0 KiB, peak: 24.3 KiB,
+//          live: 24.3 KiB
+//
+
+
+struct allocation_counts
+{
+    uint64_t allocations       = 0;
+    uint64_t deallocations     = 0;
+    uint64_t bytes             = 0; // allocated
+    uint64_t freed_bytes       = 0;
+    uint64_t reallocations     = 0;
+    uint64_t reallocated_bytes = 0; // freed by reallocations
+    uint64_t peak_bytes        = 0; // of live bytes
+
+    uint64_t live_bytes() const {
+        return bytes - freed_bytes;
+    }
+
+    std::string to_string() const {
+        return std::format("allocations: {}, {}, reallocations: {} moving {}, peak: {}, live: {}",
+                           allocations, bytesToHumanString(bytes), reallocations,
+                           bytesToHumanString(reallocated_bytes), bytesToHumanString(peak_bytes),
+                           bytesToHumanString(live_bytes()));
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const allocation_counts &counts) {
+        return os << counts.to_string();
+    }
+};
+
+
+namespace detail {
+struct allocation_counters
+{
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> deallocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> freed_bytes{0};
+    std::atomic<uint64_t> reallocations{0};
+    std::atomic<uint64_t> reallocated_bytes{0};
+    std::atomic<uint64_t> peak_bytes{0};
+
+    // The last operation if it was an allocation, to spot reallocations.
+    std::atomic<const std::type_info *> lastType{nullptr};
+    std::atomic<uint64_t>               lastBytes{0};
+
+    void allocated(uint64_t n, const std::type_info &type) noexcept {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t total = bytes.fetch_add(n, std::memory_order_relaxed) + n;
+        const uint64_t live  = total - freed_bytes.load(std::memory_order_relaxed);
+        uint64_t       peak  = peak_bytes.load(std::memory_order_relaxed);
+        while(live > peak
+              && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        lastType.store(&type, std::memory_order_relaxed);
+        lastBytes.store(n, std::memory_order_relaxed);
+    }
+
+    void deallocated(uint64_t n, const std::type_info &type) noexcept {
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+        freed_bytes.fetch_add(n, std::memory_order_relaxed);
+        if(lastBytes.exchange(0, std::memory_order_relaxed) > n
+           && lastType.load(std::memory_order_relaxed) == &type) {
+            reallocations.fetch_add(1, std::memory_order_relaxed);
+            reallocated_bytes.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    allocation_counts load() const {
+        return {allocations.load(),       deallocations.load(), bytes.load(),
+                freed_bytes.load(),       reallocations.load(), reallocated_bytes.load(),
+                peak_bytes.load()};
+    }
+};
+
+
+struct allocator_registry
+{
+    std::mutex                                                               mutex;
+    std::map<std::string, std::shared_ptr<allocation_counters>, std::less<>> tags;
+
+    static allocator_registry &instance() {
+        static allocator_registry registry;
+        return registry;
+    }
+};
+
+
+inline std::shared_ptr<allocation_counters> counters_for_tag(std::string_view tag) {
+    auto           &registry = allocator_registry::instance();
+    std::lock_guard lock(registry.mutex);
+    auto            it = registry.tags.find(tag);
+    if(it == registry.tags.end()) {
+        it = registry.tags.emplace(tag, std::make_shared<allocation_counters>()).first;
+    }
+    return it->second;
+}
+} // namespace detail
+
+
+template<typename T, typename Upstream = std::allocator<T>> struct counting_allocator
+{
+    using value_type = T;
+    using upstream   = typename std::allocator_traits<Upstream>::template rebind_alloc<T>;
+
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+    using is_always_equal                        = std::false_type;
+
+    template<typename U> struct rebind
+    {
+        using other = counting_allocator<U, Upstream>;
+    };
+
+    // Counts for one container.
+    counting_allocator()
+        : m_counters(std::make_shared<detail::allocation_counters>()) {}
+
+    explicit counting_allocator(const Upstream &upstream)
+        : m_upstream(upstream)
+        , m_counters(std::make_shared<detail::allocation_counters>()) {}
+
+    // Counts for all containers with this tag.
+    explicit counting_allocator(std::string_view tag, const Upstream &upstream = Upstream())
+        : m_upstream(upstream)
+        , m_counters(detail::counters_for_tag(tag))
+        , m_tagged(true) {}
+
+    // A move copies, the moved-from allocator keeps counting into the same counts and stays usable.
+    counting_allocator(const counting_allocator &) = default;
+
+    counting_allocator(counting_allocator &&other) noexcept
+        : counting_allocator(other) {}
+
+    counting_allocator &operator=(const counting_allocator &) = default;
+
+    counting_allocator &operator=(counting_allocator &&other) noexcept {
+        return *this = other;
+    }
+
+    template<typename U, typename UpstreamU>
+    counting_allocator(const counting_allocator<U, UpstreamU> &other)
+        : m_upstream(other.m_upstream)
+        , m_counters(other.m_counters)
+        , m_tagged(other.m_tagged) {}
+
+    T *allocate(size_t n) {
+        T *p = std::allocator_traits<upstream>::allocate(m_upstream, n);
+        m_counters->allocated(n * sizeof(T), typeid(T));
+        return p;
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        m_counters->deallocated(n * sizeof(T), typeid(T));
+        std::allocator_traits<upstream>::deallocate(m_upstream, p, n);
+    }
+
+    // A copied container counts on its own, unless the allocator is tagged.
+    counting_allocator select_on_container_copy_construction() const {
+        counting_allocator copy(*this);
+        if(!m_tagged) {
+            copy.m_counters = std::make_shared<detail::allocation_counters>();
+        }
+        return copy;
+    }
+
+    allocation_counts counts() const {
+        return m_counters->load();
+    }
+
+    // Memory from one can be freed by the other, whatever they count.
+    template<typename U, typename UpstreamU>
+    friend bool operator==(const counting_allocator               &lhs,
+                           const counting_allocator<U, UpstreamU> &rhs) {
+        return lhs.m_upstream == rhs.m_upstream;
+    }
+
+private:
+    template<typename, typename> friend struct counting_allocator;
+
+    upstream                                     m_upstream;
+    std::shared_ptr<detail::allocation_counters> m_counters;
+    bool                                         m_tagged = false;
+};
+
+
+// The counts of all containers with this tag, all zero for an unknown tag.
+inline allocation_counts allocation_counts_for(std::string_view tag) {
+    auto           &registry = detail::allocator_registry::instance();
+    std::lock_guard lock(registry.mutex);
+    auto            it = registry.tags.find(tag);
+    return it == registry.tags.end() ? allocation_counts{} : it->second->load();
+}
+
+
+// Prints the counts of all tags, most bytes first.
+inline void allocator_report(std::ostream &os = std::cout) {
+    std::vector<std::pair<std::string, allocation_counts>> tags;
+    {
+        auto           &registry = detail::allocator_registry::instance();
+        std::lock_guard lock(registry.mutex);
+        for(const auto &[tag, counters]: registry.tags) {
+            tags.emplace_back(tag, counters->load());
+        }
+    }
+    std::stable_sort(tags.begin(), tags.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second.bytes > rhs.second.bytes;
+    });
+
+    os << "allocators by bytes:\n";
+    for(const auto &[tag, counts]: tags) {
+        os << "    " << tag << ": " << counts << "\n";
+    }
+    os << std::flush;
+}
+
+
+} // namespace tesuji::tracked
@@ -0,0 +1,680 @@
+#pragma once
+
+// This file is licensed under the Creative Commons Attribution 4.0 International Public License (CC
+// BY 4.0).
+// See https://creativecommons.org/licenses/by/4.0/legalcode for the full license text.
+// github.com/sudosandwich/tesuji
+
+#include "arena.hpp"
+#include "symbolize.hpp"
+#include "timed.hpp"
+#include "tracked.hpp"
+
+#include <array>
+#include <format>
+#include <map>
+#include <new>
+#include <numeric>
+#include <unordered_map>
+
+// The clock that times the lifetimes of allocations.
+#ifndef TESUJI_HEAP_CLOCK
+#    define TESUJI_HEAP_CLOCK std::chrono::steady_clock
+#endif
+
+#if defined(_MSC_VER)
+#    include <malloc.h>
+#endif
+
+
+namespace tesuji::tracked {
+
+using heap_clock = TESUJI_HEAP_CLOCK;
+using std::chrono::nanoseconds;
+using namespace std::chrono_literals;
+
+// Provides tracking of every heap allocation in the process, not just of B and D. Define
+// TESUJI_TRACK_HEAP in exactly one translation unit before including this header, that replaces
+// the global operator new and delete in all their forms: plain, array, sized, aligned and nothrow.
+// Every allocation is recorded with its size, its call site and the thread that made it.
+//      heap_snapshot heap_snapshot_now();
+//      void heap_report(std::ostream &os = std::cout, size_t top = 10, bool histograms = false);
+//      std::string pool_candidate(const heap_site &site, const pool_rule &rule = {});
+//
+// The call site is the return address of operator new. The allocate functions of the standard
+// allocators are inlined, so for containers that is the function that grows the container. Sites
+// are named by `symbolize()` (symbolize.hpp). Allocations are kept in hash tables sharded by
+// address, each with a mutex, so a free from another thread is as cheap as one from the
+// allocating thread.
+//
+// Also provides a memory scope that reports what a thread allocated, freed and its peak live bytes
+// while the scope was open, alone or on the line of a `timed::block`.
+//      struct memory_scope;
+//
+// Every site keeps a histogram of its allocation sizes and of the lifetimes of its allocations,
+// timed with TESUJI_HEAP_CLOCK (std::chrono::steady_clock unless defined otherwise). Sites with
+// many short-lived allocations of one size are reported as candidates for a pool or an arena.
+// The `tesuji::arena`s and `tesuji::pool`s of arena.hpp are listed with the allocations they
+// served without operator new.
+//
+// Example:
+//      #define TESUJI_TRACK_HEAP
+//      #include "tesuji/tracked_heap.hpp"
+//
+//      int main() {
+//          run_service();
+//          tracked::heap_report();
+//      }
+// Possible output:
+//      heap: live: 1.2 MiB in 1032 allocations, peak: 40.1 MiB, total: 120.3 MiB in 1203344
+//      allocations
+//      top allocation sites by bytes:
+//          parse_line(std::string_view)+0x4f (app): 100321 allocations, 96.1 MiB, live: 0 B
+//          load_config()+0x1a2 (app): 2 allocations, 1.1 MiB, live: 1.1 MiB
+//      pool or arena candidates:
+//          parse_line(std::string_view)+0x4f (app): 100% of 100321 allocations in 896-1023 B, 99%
+//          freed within 1ms
+//      absorbed by arenas and pools:
+//          request: 1200318 of 1200321 allocations, 96.1 MiB, 448.0 KiB from upstream in 3
+//          allocations
+//      live bytes by thread:
+//          thread 1: 1.2 MiB
+//
+
+
+// Allocation sizes in size classes, four per power of two like the classes of jemalloc, and
+// lifetimes from new to delete in power of two nanosecond buckets.
+struct heap_histograms
+{
+    static constexpr size_t size_classes     = 4 * 48;
+    static constexpr size_t lifetime_buckets = 48;
+
+    std::array<uint64_t, size_classes>     sizes{};
+    std::array<uint64_t, lifetime_buckets> lifetimes{}; // of the freed allocations
+
+    static size_t size_class(size_t size) {
+        if(size < 4) {
+            return size;
+        }
+        const size_t log2 = std::bit_width(size) - 1;
+        return std::min(log2 * 4 + ((size >> (log2 - 2)) & 3), size_classes - 1);
+    }
+
+    // The smallest and largest size in a class.
+    static std::pair<size_t, size_t> size_class_range(size_t index) {
+        if(index < 4) {
+            return {index, index};
+        }
+        const size_t log2  = index / 4;
+        const size_t lower = (4 + index % 4) << (log2 - 2);
+        return {lower, lower + (size_t(1) << (log2 - 2)) - 1};
+    }
+
+    static size_t lifetime_bucket(uint64_t nanoseconds) {
+        return std::min<size_t>(std::bit_width(nanoseconds), lifetime_buckets - 1);
+    }
+
+    // The allocations in power of two buckets, index i holds sizes in [2^i, 2^(i+1)).
+    std::array<uint64_t, size_classes / 4> power_of_two_sizes() const {
+        std::array<uint64_t, size_classes / 4> result{};
+        for(size_t i = 0; i < size_classes; ++i) {
+            result[i < 4 ? std::bit_width(i) - (i > 0) : i / 4] += sizes[i];
+        }
+        return result;
+    }
+
+    uint64_t freed() const {
+        return std::accumulate(lifetimes.begin(), lifetimes.end(), uint64_t(0));
+    }
+
+    heap_histograms &operator+=(const heap_histograms &rhs) {
+        for(size_t i = 0; i < size_classes; ++i) {
+            sizes[i] += rhs.sizes[i];
+        }
+        for(size_t i = 0; i < lifetime_buckets; ++i) {
+            lifetimes[i] += rhs.lifetimes[i];
+        }
+        return *this;
+    }
+};
+
+
+struct heap_site
+{
+    void           *address          = nullptr; // the return address of operator new
+    uint64_t        allocations      = 0;
+    uint64_t        bytes            = 0;
+    uint64_t        live_allocations = 0;
+    uint64_t        live_bytes       = 0;
+    heap_histograms histograms;
+};
+
+
+// When a site counts as a candidate for a pool or an arena: it allocated often, mostly one size
+// class and most of its allocations were freed again quickly.
+struct pool_rule
+{
+    uint64_t    min_allocations = 1000;
+    double      same_size       = 0.9; // fraction of allocations in the most common size class
+    nanoseconds short_lifetime  = 1ms;
+    double      short_lived     = 0.9; // fraction of freed allocations shorter than short_lifetime
+};
+
+
+// Why `site` is a pool candidate, or an empty string if it is none.
+inline std::string pool_candidate(const heap_site &site, const pool_rule &rule = {}) {
+    const auto  &h = site.histograms;
+    const size_t common =
+        size_t(std::max_element(h.sizes.begin(), h.sizes.end()) - h.sizes.begin());
+    const double sameSize =
+        site.allocations ? double(h.sizes[common]) / double(site.allocations) : 0;
+
+    uint64_t shortLived = 0;
+    for(size_t i = 0; i < heap_histograms::lifetime_buckets; ++i) {
+        // bucket i holds lifetimes below 2^i ns
+        if((uint64_t(1) << i) <= uint64_t(rule.short_lifetime.count())) {
+            shortLived += h.lifetimes[i];
+        }
+    }
+    const uint64_t freed         = h.freed();
+    const double   shortFraction = freed ? double(shortLived) / double(freed) : 0;
+
+    if(site.allocations < rule.min_allocations || sameSize < rule.same_size
+       || shortFraction < rule.short_lived) {
+        return {};
+    }
+    const auto [lower, upper] = heap_histograms::size_class_range(common);
+    return std::format("{:.0f}% of {} allocations in {}-{} B, {:.0f}% freed within {}",
+                       100 * sameSize, site.allocations, lower, upper, 100 * shortFraction,
+                       timed::durationToHumanString(rule.short_lifetime));
+}
+
+
+struct heap_snapshot
+{
+    uint64_t live_bytes       = 0;
+    uint64_t peak_bytes       = 0;
+    uint64_t live_allocations = 0;
+    uint64_t allocations      = 0;
+    uint64_t bytes            = 0;
+
+    std::vector<heap_site>                              sites;           // most bytes first
+    std::vector<size_t>                                 pool_candidates; // indices into sites
+    std::vector<std::pair<uint32_t, uint64_t>>          live_bytes_by_thread;
+    std::vector<std::pair<std::string, resource_stats>> resources; // arenas and pools by name
+};
+
+
+namespace detail {
+// The tracker's own memory must not come from the operator new it instruments.
+template<typename T> struct malloc_allocator
+{
+    using value_type = T;
+
+    malloc_allocator() = default;
+    template<typename U> malloc_allocator(const malloc_allocator<U> &) {}
+
+    T *allocate(size_t n) {
+        if(void *p = std::malloc(n * sizeof(T))) {
+            return static_cast<T *>(p);
+        }
+        throw std::bad_alloc();
+    }
+
+    void deallocate(T *p, size_t) {
+        std::free(p);
+    }
+
+    friend bool operator==(const malloc_allocator &, const malloc_allocator &) {
+        return true;
+    }
+};
+
+
+struct heap_allocation
+{
+    void               *address = nullptr;
+    allocation::state_t state   = allocation::empty;
+    size_t              size    = 0;
+    void               *site    = nullptr;
+    uint32_t            thread  = 0;
+    int64_t             born    = 0; // heap_clock nanoseconds
+};
+
+
+struct heap_site_entry
+{
+    void               *address          = nullptr; // of the call site
+    allocation::state_t state            = allocation::empty;
+    uint64_t            allocations      = 0;
+    uint64_t            bytes            = 0;
+    uint64_t            live_allocations = 0;
+    uint64_t            live_bytes       = 0;
+    heap_histograms     histograms;
+};
+
+
+// Set while the tracker allocates for itself, e.g. to build a report.
+inline thread_local bool heapUntracked = false;
+
+
+// What the calling thread allocated and freed, for memory_scope.
+struct thread_memory
+{
+    uint64_t allocated     = 0;
+    uint64_t freed         = 0;
+    uint64_t allocations   = 0;
+    uint64_t deallocations = 0;
+    int64_t  live          = 0; // allocated - freed, negative if it freed what others allocated
+    int64_t  peak          = 0; // highest live since the innermost memory_scope opened
+};
+
+inline thread_local thread_memory threadMemory;
+
+
+inline int64_t heap_now() {
+    return duration_cast<std::chrono::nanoseconds>(heap_clock::now().time_since_epoch()).count();
+}
+
+
+inline uint32_t heap_thread_id() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t        id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+
+struct heap_tracker
+{
+    static constexpr size_t shard_count = 64;
+
+    struct shard
+    {
+        std::mutex                                                      mutex;
+        alloc_table<heap_allocation, malloc_allocator<heap_allocation>> allocations;
+        alloc_table<heap_site_entry, malloc_allocator<heap_site_entry>> sites;
+    };
+
+    std::array<shard, shard_count> shards;
+    std::atomic<uint64_t>          liveBytes{0};
+    std::atomic<uint64_t>          peakBytes{0};
+    std::atomic<uint64_t>          liveAllocations{0};
+    std::atomic<uint64_t>          allocations{0};
+    std::atomic<uint64_t>          bytes{0};
+
+    // Never destroyed, memory is freed until the very end of the process.
+    static heap_tracker &instance() {
+        alignas(heap_tracker) static unsigned char storage[sizeof(heap_tracker)];
+        static heap_tracker                       *tracker = new(storage) heap_tracker;
+        return *tracker;
+    }
+
+    shard &shard_for(void *address) {
+        const auto a = reinterpret_cast<uintptr_t>(address);
+        return shards[((a >> 4) ^ (a >> 12)) % shard_count];
+    }
+
+    void add(void *address, size_t size, void *site) {
+        if(heapUntracked) {
+            return;
+        }
+        shard &s = shard_for(address);
+        {
+            std::lock_guard lock(s.mutex);
+            heap_allocation &alloc = s.allocations.insert(address);
+            alloc.size             = size;
+            alloc.site             = site;
+            alloc.thread           = heap_thread_id();
+            alloc.born             = heap_now();
+
+            heap_site_entry *entry = s.sites.find(site);
+            if(!entry) {
+                entry = &s.sites.insert(site);
+            }
+            ++entry->allocations;
+            entry->bytes += size;
+            ++entry->live_allocations;
+            entry->live_bytes += size;
+            ++entry->histograms.sizes[heap_histograms::size_class(size)];
+        }
+
+        thread_memory &mine = threadMemory;
+        mine.allocated += size;
+        ++mine.allocations;
+        mine.live += int64_t(size);
+        mine.peak  = std::max(mine.peak, mine.live);
+
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        liveAllocations.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        uint64_t peak = peakBytes.load(std::memory_order_relaxed);
+        while(live > peak
+              && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    }
+
+    // Allocations from before tracking started or made while untracked are not found.
+    void remove(void *address) {
+        if(!address) {
+            return;
+        }
+        const int64_t now  = heap_now();
+        shard        &s    = shard_for(address);
+        size_t        size = 0;
+        {
+            std::lock_guard  lock(s.mutex);
+            heap_allocation *alloc = s.allocations.find(address);
+            if(!alloc || alloc->state != allocation::live) {
+                return;
+            }
+            size = alloc->size;
+            if(heap_site_entry *entry = s.sites.find(alloc->site)) {
+                --entry->live_allocations;
+                entry->live_bytes -= size;
+                const auto lifetime = uint64_t(std::max<int64_t>(now - alloc->born, 0));
+                ++entry->histograms.lifetimes[heap_histograms::lifetime_bucket(lifetime)];
+            }
+            s.allocations.erase(*alloc);
+        }
+        thread_memory &mine = threadMemory;
+        mine.freed += size;
+        ++mine.deallocations;
+        mine.live -= int64_t(size);
+
+        liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+        liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+
+inline void *heap_allocate(size_t size, size_t alignment) {
+    size = std::max<size_t>(size, 1);
+#if defined(_MSC_VER)
+    return alignment ? _aligned_malloc(size, alignment) : std::malloc(size);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    return alignment ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                     : std::malloc(size);
+#endif
+}
+
+
+inline void heap_free(void *p, bool aligned) {
+    heap_tracker::instance().remove(p);
+#if defined(_MSC_VER)
+    aligned ? _aligned_free(p) : std::free(p);
+#else
+    (void)aligned;
+    std::free(p);
+#endif
+}
+
+
+inline void *heap_new(size_t size, size_t alignment, void *site) {
+    void *p;
+    while(!(p = heap_allocate(size, alignment))) {
+        if(std::new_handler handler = std::get_new_handler()) {
+            handler();
+        } else {
+            throw std::bad_alloc();
+        }
+    }
+    heap_tracker::instance().add(p, size, site);
+    return p;
+}
+
+
+inline void *heap_new_nothrow(size_t size, size_t alignment, void *site) noexcept {
+    try {
+        return heap_new(size, alignment, site);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+
+struct untracked_scope
+{
+    bool previous = std::exchange(heapUntracked, true);
+
+    ~untracked_scope() {
+        heapUntracked = previous;
+    }
+};
+} // namespace detail
+
+
+inline heap_snapshot heap_snapshot_now() {
+    detail::untracked_scope untracked;
+    auto                   &tracker = detail::heap_tracker::instance();
+
+    heap_snapshot snapshot;
+    snapshot.live_bytes       = tracker.liveBytes.load();
+    snapshot.peak_bytes       = tracker.peakBytes.load();
+    snapshot.live_allocations = tracker.liveAllocations.load();
+    snapshot.allocations      = tracker.allocations.load();
+    snapshot.bytes            = tracker.bytes.load();
+
+    std::unordered_map<void *, heap_site> sites;
+    std::map<uint32_t, uint64_t>          byThread;
+    for(auto &s: tracker.shards) {
+        std::lock_guard lock(s.mutex);
+        s.sites.for_each_live([&](const detail::heap_site_entry &entry) {
+            auto &site             = sites[entry.address];
+            site.address           = entry.address;
+            site.allocations      += entry.allocations;
+            site.bytes            += entry.bytes;
+            site.live_allocations += entry.live_allocations;
+            site.live_bytes       += entry.live_bytes;
+            site.histograms       += entry.histograms;
+        });
+        s.allocations.for_each_live(
+            [&](const detail::heap_allocation &alloc) { byThread[alloc.thread] += alloc.size; });
+    }
+
+    for(auto &[address, site]: sites) {
+        snapshot.sites.push_back(std::move(site));
+    }
+    std::sort(snapshot.sites.begin(), snapshot.sites.end(),
+              [](const heap_site &lhs, const heap_site &rhs) { return lhs.bytes > rhs.bytes; });
+    snapshot.live_bytes_by_thread.assign(byThread.begin(), byThread.end());
+    for(size_t i = 0; i < snapshot.sites.size(); ++i) {
+        if(!pool_candidate(snapshot.sites[i]).empty()) {
+            snapshot.pool_candidates.push_back(i);
+        }
+    }
+    snapshot.resources = resource_totals();
+    return snapshot;
+}
+
+
+// Prints the size classes of a site that hold at least 1% of its allocations and its lifetimes.
+inline void print_histograms(std::ostream &os, const heap_site &site, size_t indent = 8) {
+    const std::string pad(indent, ' ');
+    const auto       &h = site.histograms;
+
+    const char *separator = " ";
+    os << pad << "sizes:";
+    for(size_t i = 0; i < heap_histograms::size_classes; ++i) {
+        if(h.sizes[i] * 100 >= site.allocations && h.sizes[i] > 0) {
+            const auto [lower, upper] = heap_histograms::size_class_range(i);
+            os << std::format("{}{}-{} B: {:.0f}%", separator, lower, upper,
+                              100.0 * double(h.sizes[i]) / double(site.allocations));
+            separator = ", ";
+        }
+    }
+
+    separator = " ";
+    os << "\n" << pad << "lifetimes:";
+    const uint64_t freed = h.freed();
+    for(size_t i = 0; i < heap_histograms::lifetime_buckets; ++i) {
+        if(h.lifetimes[i] * 100 >= freed && h.lifetimes[i] > 0) {
+            os << std::format("{}<{}: {:.0f}%", separator,
+                              timed::durationToHumanString(nanoseconds(uint64_t(1) << i)),
+                              100.0 * double(h.lifetimes[i]) / double(freed));
+            separator = ", ";
+        }
+    }
+    os << (freed == 0 ? " none freed\n" : "\n");
+}
+
+
+// Prints the heap totals, the `top` sites that allocated the most bytes with their histograms if
+// `histograms`, the sites that look like candidates for pooling and the live bytes of every thread.
+inline void heap_report(std::ostream &os = std::cout, size_t top = 10, bool histograms = false) {
+    heap_snapshot           snapshot = heap_snapshot_now();
+    detail::untracked_scope untracked;
+
+    os << std::format("heap: live: {} in {} allocations, peak: {}, total: {} in {} allocations\n",
+                      bytesToHumanString(snapshot.live_bytes), snapshot.live_allocations,
+                      bytesToHumanString(snapshot.peak_bytes), bytesToHumanString(snapshot.bytes),
+                      snapshot.allocations);
+
+    os << "top allocation sites by bytes:\n";
+    for(size_t i = 0; i < std::min(top, snapshot.sites.size()); ++i) {
+        const heap_site &site = snapshot.sites[i];
+        os << std::format("    {}: {} allocations, {}, live: {}\n", symbolize(site.address),
+                          site.allocations, bytesToHumanString(site.bytes),
+                          bytesToHumanString(site.live_bytes));
+        if(histograms) {
+            print_histograms(os, site);
+        }
+    }
+
+    os << "pool or arena candidates:\n";
+    for(size_t i: snapshot.pool_candidates) {
+        const heap_site &site = snapshot.sites[i];
+        os << std::format("    {}: {}\n", symbolize(site.address), pool_candidate(site));
+    }
+
+    if(!snapshot.resources.empty()) {
+        os << "absorbed by arenas and pools:\n";
+    }
+    for(const auto &[name, stats]: snapshot.resources) {
+        os << std::format("    {}: {} of {} allocations, {}, {} from upstream in {} allocations\n",
+                          name, stats.absorbed(), stats.allocations,
+                          bytesToHumanString(stats.bytes), bytesToHumanString(stats.upstream_bytes),
+                          stats.upstream_allocations);
+    }
+
+    os << "live bytes by thread:\n";
+    for(const auto &[thread, bytes]: snapshot.live_bytes_by_thread) {
+        os << std::format("    thread {}: {}\n", thread, bytesToHumanString(bytes));
+    }
+    os << std::flush;
+}
+
+
+struct memory_stats
+{
+    uint64_t allocated     = 0; // bytes
+    uint64_t freed         = 0; // bytes
+    uint64_t allocations   = 0;
+    uint64_t deallocations = 0;
+    uint64_t peak          = 0; // highest live bytes above the level at the start
+
+    int64_t net() const {
+        return int64_t(allocated) - int64_t(freed);
+    }
+
+    std::string to_string() const {
+        return std::format("allocated: {} in {}, freed: {} in {}, net: {}{}, peak: +{}",
+                           bytesToHumanString(allocated), allocations, bytesToHumanString(freed),
+                           deallocations, net() < 0 ? "-" : "+",
+                           bytesToHumanString(uint64_t(std::abs(net()))),
+                           bytesToHumanString(peak));
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const memory_stats &stats) {
+        return os << stats.to_string();
+    }
+};
+
+
+// Records what the calling thread allocates and frees while the scope is open, including nested
+// scopes, and the peak of its live bytes above the level at the start. That peak is what runs a
+// job out of memory even when the net growth of a phase is small. The counters are per thread,
+// so memory allocated here and freed by another thread shows as net growth. Scopes must nest, they
+// need TESUJI_TRACK_HEAP, without it all counts are 0.
+//
+// A scope prints its stats to `os` when it closes. Constructed with a `timed::block`, it adds them
+// to the block's line instead, so declare it after the block.
+//
+// Example:
+//      timed::block b("parse");
+//      tracked::memory_scope m(b);
+//      parse(input);
+// Possible output:
+//      parse: 120ms, allocated: 1.2 GiB in 30211, freed: 1.1 GiB in 30011, net: +96.0 MiB, peak:
+//      +812.4 MiB
+struct memory_scope
+{
+    memory_scope(std::string_view name = "memory_scope", std::ostream &os = std::cout)
+        : m_name(name)
+        , m_os(&os) {}
+
+    template<size_t IndentFactor>
+    memory_scope(timed::block<IndentFactor> &block)
+        : m_note(&block.note) {}
+
+    memory_scope(const memory_scope &)            = delete;
+    memory_scope &operator=(const memory_scope &) = delete;
+
+    ~memory_scope() {
+        const memory_stats result = stats();
+        detail::threadMemory.peak = std::max(m_outerPeak, detail::threadMemory.peak);
+
+        detail::untracked_scope untracked;
+        if(m_note) {
+            m_note->append(m_note->empty() ? "" : ", ").append(result.to_string());
+        } else {
+            *m_os << m_name << ": " << result << "\n";
+        }
+    }
+
+    // What happened so far.
+    memory_stats stats() const {
+        const detail::thread_memory &now = detail::threadMemory;
+        return {now.allocated - m_start.allocated, now.freed - m_start.freed,
+                now.allocations - m_start.allocations, now.deallocations - m_start.deallocations,
+                uint64_t(now.peak - m_start.live)};
+    }
+
+private:
+    std::string           m_name;
+    std::ostream         *m_os   = nullptr;
+    std::string          *m_note = nullptr;
+    int64_t               m_outerPeak =
+        std::exchange(detail::threadMemory.peak, detail::threadMemory.live);
+    detail::thread_memory m_start = detail::threadMemory;
+};
+
+
+} // namespace tesuji::tracked
+
+
+#if defined(TESUJI_TRACK_HEAP)
+// clang-format off
+void *operator new(std::size_t size) { return tesuji::tracked::detail::heap_new(size, 0, TESUJI_RETURN_ADDRESS()); }
+void *operator new[](std::size_t size) { return tesuji::tracked::detail::heap_new(size, 0, TESUJI_RETURN_ADDRESS()); }
+void *operator new(std::size_t size, std::align_val_t al) { return tesuji::tracked::detail::heap_new(size, size_t(al), TESUJI_RETURN_ADDRESS()); }
+void *operator new[](std::size_t size, std::align_val_t al) { return tesuji::tracked::detail::heap_new(size, size_t(al), TESUJI_RETURN_ADDRESS()); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return tesuji::tracked::detail::heap_new_nothrow(size, 0, TESUJI_RETURN_ADDRESS()); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return tesuji::tracked::detail::heap_new_nothrow(size, 0, TESUJI_RETURN_ADDRESS()); }
+void *operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return tesuji::tracked::detail::heap_new_nothrow(size, size_t(al), TESUJI_RETURN_ADDRESS()); }
+void *operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return tesuji::tracked::detail::heap_new_nothrow(size, size_t(al), TESUJI_RETURN_ADDRESS()); }
+
+void operator delete(void *p) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete[](void *p) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete(void *p, std::size_t) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete[](void *p, std::size_t) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { tesuji::tracked::detail::heap_free(p, false); }
+void operator delete(void *p, std::align_val_t) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+void operator delete[](void *p, std::align_val_t) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { tesuji::tracked::detail::heap_free(p, true); }
+// clang-format on
+#endif